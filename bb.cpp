@@ -4,6 +4,10 @@
 
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
 #include "bb.h"
 
 /*
@@ -162,6 +166,34 @@ namespace bb_sliders {
 
     U64 attacks[88772];
 
+    // Dense tables for PEXT lookups, with 2^bits entries for each square
+    U64 pext_attacks[5248 + 102400];
+    bool use_pext = false;
+
+    bool fast_pext() {
+#if defined(__BMI2__) && (defined(__x86_64__) || defined(__i386__))
+        unsigned eax, ebx, ecx, edx;
+
+        // BMI2 support
+        if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) || !(ebx & (1u << 8u))) return false;
+
+        // Vendor is "AuthenticAMD"
+        __get_cpuid(0, &eax, &ebx, &ecx, &edx);
+        if (ebx == 0x68747541 && edx == 0x69746e65 && ecx == 0x444d4163) {
+            __get_cpuid(1, &eax, &ebx, &ecx, &edx);
+            unsigned family = ((eax >> 8u) & 0xFu) + ((eax >> 20u) & 0xFFu);
+            return family >= 0x19; // Zen 3
+        }
+
+        // Vendor is "HygonGenuine": Hygon processors are built on Zen 1, family 0x18
+        if (ebx == 0x6f677948 && edx == 0x6e65476e && ecx == 0x656e6975) return false;
+
+        return true;
+#else
+        return false;
+#endif
+    }
+
     // Use kogge-stone occluded shifts to (slowly) generate bishop moves for the lookup table
     U64 compute_bishop_moves(int sq, U64 occupancy) {
         U64 open = ~occupancy;
@@ -196,26 +228,33 @@ namespace bb_sliders {
 
     // Initialisation code
     void init_sliders() {
+        U64 *pext_base = pext_attacks;
         for (int sq = 0; sq < 64; sq++) {
             sq_entry_t entry = {};
             unsigned bits;
 
-            entry = {compute_bishop_mask(sq), bishop_magics[sq].factor, attacks + bishop_magics[sq].position};
+            entry = {compute_bishop_mask(sq), bishop_magics[sq].factor, attacks + bishop_magics[sq].position, pext_base};
             bits = pop_count(entry.mask);
             for (U64 dense_occ = 0; dense_occ < (1u << bits); dense_occ++) {
                 U64 occ = bb_intrin::pdep(dense_occ, entry.mask); // pdep an incrementing bitfield for all relevant bitboards
                 entry.base[(occ * entry.magic) >> (64u - 9u)] = compute_bishop_moves(sq, occ);
+                entry.pext_base[dense_occ] = compute_bishop_moves(sq, occ); // pext(occ, mask) == dense_occ
             }
             b_table[sq] = entry;
+            pext_base += 1u << bits;
 
-            entry = {compute_rook_mask(sq), rook_magics[sq].factor, attacks + rook_magics[sq].position};
+            entry = {compute_rook_mask(sq), rook_magics[sq].factor, attacks + rook_magics[sq].position, pext_base};
             bits = pop_count(entry.mask);
             for (U64 dense_occ = 0; dense_occ < (1u << bits); dense_occ++) {
                 U64 occ = bb_intrin::pdep(dense_occ, entry.mask);
                 entry.base[(occ * entry.magic) >> (64u - 12u)] = compute_rook_moves(sq, occ);
+                entry.pext_base[dense_occ] = compute_rook_moves(sq, occ);
             }
             r_table[sq] = entry;
+            pext_base += 1u << bits;
         }
+
+        use_pext = fast_pext();
     }
 }
 
@@ -350,6 +389,35 @@ void init_tables() {
     bb_normal_moves::init_normal_moves();
 }
 
+std::string kernel_target() {
+    std::string target;
+#ifdef TOPPLE_CLONES
+    // Mirrors the priority of the target_clones resolver
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("x86-64-v3")) {
+        target = "x86-64-v3";
+    } else if (__builtin_cpu_supports("x86-64-v2")) {
+        target = "x86-64-v2";
+    } else {
+        target = "x86-64";
+    }
+    target += " dispatched";
+#else
+    target = "compiled for";
+#ifdef __POPCNT__
+    target += " popcnt";
+#endif
+#ifdef __BMI2__
+    target += " bmi2";
+#endif
+#ifdef __AVX2__
+    target += " avx2";
+#endif
+    if (target == "compiled for") target += " generic";
+#endif
+    return target + (bb_sliders::use_pext ? ", pext sliders" : ", magic sliders");
+}
+
 uint8_t to_sq(char file, char rank) {
     if (file >= 'a' && file <= 'h' && rank >= '1' && rank <= '8') {
         return square_index(uint8_t(file - 'a'), uint8_t(rank - '1'));
@@ -238,7 +238,7 @@ namespace bb_intrin {
      * @param mask
      * @return result
      */
-    inline U64 pext(U64 source, U64 mask) { // unused
+    inline U64 pext(U64 source, U64 mask) {
 #ifdef __BMI2__
         return _pext_u64(source, mask);
 #else
@@ -285,18 +285,31 @@ namespace bb_intrin {
 
 /*
  * Lookup functions for sliding move generation.
- * Uses fixed-shift magic bitboard lookups - see bb.cpp for computation of lookup table
+ * Uses fixed-shift magic bitboard lookups, or PEXT indexed lookups on CPUs with fast PEXT - see bb.cpp for computation
+ * of lookup tables
  */
 namespace bb_sliders {
     struct sq_entry_t {
         U64 mask;
         U64 magic;
-        U64 *base;
+        U64 *base; // Indexed by magic multiplication
+        U64 *pext_base; // Indexed by PEXT
     };
 
     extern sq_entry_t b_table[64];
     extern sq_entry_t r_table[64];
 
+    // Whether slider lookups use PEXT rather than magics. Only has an effect if compiled with BMI2.
+    extern bool use_pext;
+
+    /**
+     * Checks if this build can use PEXT lookups, and PEXT is fast on the current CPU. AMD processors before Zen 3
+     * and Hygon processors implement PEXT in microcode, which is slower than a magic multiplication.
+     *
+     * @return true if PEXT lookups should be preferred
+     */
+    bool fast_pext();
+
     /**
      * Compute the bitboard of squares that a bishop on sq can move to, if
      * occupancy is the set of squares occupied by pieces. Includes captures.
@@ -306,7 +319,10 @@ namespace bb_sliders {
      * @return set of possible bishop moves
      */
     inline U64 bishop_moves(uint8_t sq, U64 occupancy) {
-        sq_entry_t entry = b_table[sq];
+        const sq_entry_t &entry = b_table[sq];
+#ifdef __BMI2__
+        if (use_pext) return entry.pext_base[bb_intrin::pext(occupancy, entry.mask)];
+#endif
         return entry.base[((occupancy & entry.mask) * entry.magic) >> (64u - 9u)];
     }
 
@@ -319,7 +335,10 @@ namespace bb_sliders {
      * @return set of possible rook moves
      */
     inline U64 rook_moves(uint8_t sq, U64 occupancy) {
-        sq_entry_t entry = r_table[sq];
+        const sq_entry_t &entry = r_table[sq];
+#ifdef __BMI2__
+        if (use_pext) return entry.pext_base[bb_intrin::pext(occupancy, entry.mask)];
+#endif
         return entry.base[((occupancy & entry.mask) * entry.magic) >> (64u - 12u)];
     }
 }
@@ -350,6 +369,14 @@ namespace bb_normal_moves {
  */
 void init_tables();
 
+/**
+ * Describe the code paths used by the hot kernels (popcount, bit scans, slider lookups and evaluation) on this CPU.
+ * Portable builds select an instruction set level at load time, other builds use the compiler target.
+ *
+ * @return description of the selected kernels, e.g. "x86-64-v3 dispatched, magic sliders"
+ */
+std::string kernel_target();
+
 /**
  * Generate a bitboard of possible moves from the {@code square}, assuming that {@code occupied} is a bitboard which
  * represents the occupied square on the board.
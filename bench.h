@@ -0,0 +1,38 @@
+#ifndef TOPPLE_BENCH_H
+#define TOPPLE_BENCH_H
+
+#include <string>
+#include <vector>
+
+#include "types.h"
+#include "eval.h"
+
+/**
+ * A fixed set of varied positions (openings, middlegames and endgames) used for benchmarking
+ */
+extern const std::vector<std::string> bench_positions;
+
+/**
+ * Search each of the benchmark positions to a fixed depth, from an empty hash table, and print the total number of
+ * nodes searched, the time taken and the speed. With one thread, the node count is reproducible, and so can be used
+ * to check that a change does not alter the behaviour of the search.
+ *
+ * @param params evaluation parameters
+ * @param depth depth to search each position to
+ * @param threads number of search threads
+ * @param hash_size size of the hash table in MiB
+ * @return total number of nodes searched
+ */
+U64 bench(const processed_params_t &params, int depth, size_t threads, size_t hash_size);
+
+/**
+ * Run the benchmark with the arguments of the bench command, [depth] [threads] [hash], defaulting to depth 12 with
+ * 1 thread and 16 MiB of hash. If an argument is not a number in range, a usage message is printed instead.
+ *
+ * @param params evaluation parameters
+ * @param args arguments following the bench command
+ * @return true if the arguments were valid and the benchmark was run
+ */
+bool bench(const processed_params_t &params, const std::vector<std::string> &args);
+
+#endif //TOPPLE_BENCH_H
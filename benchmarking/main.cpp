@@ -0,0 +1,398 @@
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <chrono>
+#include <utility>
+
+#include "../bb.h"
+#include "../board.h"
+#include "../movegen.h"
+#include "../eval.h"
+#include "../hash.h"
+#include "../bench.h"
+
+namespace {
+    volatile U64 sink;
+
+    struct result_t {
+        std::string name;
+        U64 ops; // Operations per run
+        double mean, stddev, min; // ns/op
+        size_t runs;
+    };
+
+    /**
+     * Time a batch of operations several times, after one untimed warm-up run
+     *
+     * @param name name of the benchmark
+     * @param runs number of timed runs
+     * @param setup called before every run, untimed
+     * @param batch performs a run, returning the number of operations performed
+     */
+    result_t measure(const std::string &name, size_t runs,
+                     const std::function<void()> &setup, const std::function<U64()> &batch) {
+        std::vector<double> samples;
+        U64 ops = 0;
+
+        for (size_t run = 0; run <= runs; run++) {
+            setup();
+
+            auto start = std::chrono::steady_clock::now();
+            ops = batch();
+            auto finish = std::chrono::steady_clock::now();
+
+            if (run == 0 || ops == 0) continue; // Warm-up
+            double ns = std::chrono::duration<double, std::nano>(finish - start).count();
+            samples.push_back(ns / ops);
+        }
+
+        double mean = 0, variance = 0, min = samples.empty() ? 0 : samples[0];
+        for (double sample : samples) {
+            mean += sample;
+            min = std::min(min, sample);
+        }
+        mean /= std::max(size_t(1), samples.size());
+        for (double sample : samples) {
+            variance += (sample - mean) * (sample - mean);
+        }
+        variance /= std::max(size_t(1), samples.size() - 1);
+
+        return {name, ops, mean, std::sqrt(variance), min, samples.size()};
+    }
+
+    result_t measure(const std::string &name, size_t runs, const std::function<U64()> &batch) {
+        return measure(name, runs, [] () {}, batch);
+    }
+
+    /**
+     * Build a corpus of positions by playing random legal moves from each of the benchmark positions
+     */
+    std::vector<board_t> build_corpus(size_t plies) {
+        std::mt19937_64 gen(0);
+        std::vector<board_t> corpus;
+
+        for (const std::string &fen : bench_positions) {
+            board_t board(fen);
+            for (size_t ply = 0; ply < plies; ply++) {
+                corpus.push_back(board);
+
+                move_t buf[256];
+                movegen_t movegen(board);
+                int n = movegen.gen_normal(buf);
+
+                std::vector<move_t> legal;
+                for (int i = 0; i < n; i++) {
+                    if (board.is_legal(buf[i])) legal.push_back(buf[i]);
+                }
+                if (legal.empty() || board.now().halfmove_clock >= 100) break;
+
+                board.move(legal[gen() % legal.size()]);
+            }
+        }
+
+        return corpus;
+    }
+
+    void print_text(const std::vector<result_t> &results) {
+        for (const result_t &result : results) {
+            std::cout << std::left << std::setw(24) << result.name << std::right << std::fixed << std::setprecision(2)
+                      << std::setw(10) << result.mean << " ns/op"
+                      << " +/- " << std::setw(6) << result.stddev
+                      << "  min " << std::setw(8) << result.min
+                      << "  (" << result.runs << " runs of " << result.ops << " ops)" << std::endl;
+        }
+    }
+
+    void print_json(const std::vector<result_t> &results) {
+        std::cout << "[" << std::endl;
+        for (size_t i = 0; i < results.size(); i++) {
+            const result_t &result = results[i];
+            std::cout << "  {\"name\": \"" << result.name << "\", \"ns_per_op\": " << result.mean
+                      << ", \"stddev\": " << result.stddev << ", \"min\": " << result.min
+                      << ", \"runs\": " << result.runs << ", \"ops\": " << result.ops << "}"
+                      << (i + 1 < results.size() ? "," : "") << std::endl;
+        }
+        std::cout << "]" << std::endl;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    init_tables();
+    evaluator_t::eval_init();
+
+    bool json = false;
+    size_t runs = 10;
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--json") == 0) {
+            json = true;
+        } else if (std::strcmp(argv[i], "--runs") == 0 && i + 1 < argc) {
+            runs = std::stoul(argv[++i]);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--json] [--runs n]" << std::endl;
+            return 1;
+        }
+    }
+
+    std::vector<board_t> corpus = build_corpus(80);
+
+    // Precompute moves for each position
+    std::vector<std::vector<move_t>> pseudo_legal(corpus.size()), legal(corpus.size()), captures(corpus.size());
+    for (size_t i = 0; i < corpus.size(); i++) {
+        move_t buf[256];
+        movegen_t movegen(corpus[i]);
+        int n = movegen.gen_normal(buf);
+        for (int j = 0; j < n; j++) {
+            pseudo_legal[i].push_back(buf[j]);
+            if (corpus[i].is_legal(buf[j])) legal[i].push_back(buf[j]);
+        }
+
+        n = movegen.gen_noisy(buf);
+        captures[i].assign(buf, buf + n);
+    }
+
+    std::vector<result_t> results;
+
+    // Move generation, in the legal mode used by the search. Evasions are only generated in check, and quiet checks
+    // only out of check.
+    std::vector<const board_t *> in_check, not_in_check;
+    for (const board_t &board : corpus) {
+        (board.is_incheck() ? in_check : not_in_check).push_back(&board);
+    }
+
+    results.push_back(measure("gen_normal", runs, [&] () {
+        move_t buf[256];
+        U64 total = 0;
+        for (const board_t &board : corpus) {
+            movegen_t movegen(board, true);
+            total += movegen.gen_normal(buf);
+        }
+        sink = total;
+        return corpus.size();
+    }));
+
+    results.push_back(measure("gen_noisy", runs, [&] () {
+        move_t buf[256];
+        U64 total = 0;
+        for (const board_t *board : not_in_check) {
+            movegen_t movegen(*board, true);
+            total += movegen.gen_noisy(buf);
+        }
+        sink = total;
+        return not_in_check.size();
+    }));
+
+    results.push_back(measure("gen_quiets", runs, [&] () {
+        move_t buf[256];
+        U64 total = 0;
+        for (const board_t *board : not_in_check) {
+            movegen_t movegen(*board, true);
+            total += movegen.gen_quiets(buf);
+        }
+        sink = total;
+        return not_in_check.size();
+    }));
+
+    results.push_back(measure("gen_evasions", runs, [&] () {
+        move_t buf[256];
+        U64 total = 0;
+        for (const board_t *board : in_check) {
+            movegen_t movegen(*board, true);
+            total += movegen.gen_evasions(buf);
+        }
+        sink = total;
+        return in_check.size();
+    }));
+
+    results.push_back(measure("gen_quiet_checks", runs, [&] () {
+        move_t buf[256];
+        U64 total = 0;
+        for (const board_t *board : not_in_check) {
+            movegen_t movegen(*board, true);
+            total += movegen.gen_quiet_checks(buf);
+        }
+        sink = total;
+        return not_in_check.size();
+    }));
+
+    // Making and unmaking moves
+    results.push_back(measure("move/unmove", runs, [&] () {
+        U64 ops = 0, total = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            for (move_t move : legal[i]) {
+                corpus[i].move(move);
+                total += corpus[i].now().hash;
+                corpus[i].unmove();
+                ops++;
+            }
+        }
+        sink = total;
+        return ops;
+    }));
+
+    // Move properties
+    results.push_back(measure("see", runs, [&] () {
+        U64 ops = 0, total = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            for (move_t move : captures[i]) {
+                total += corpus[i].see(move);
+                ops++;
+            }
+        }
+        sink = total;
+        return ops;
+    }));
+
+    results.push_back(measure("see_ge", runs, [&] () {
+        U64 ops = 0, total = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            for (move_t move : captures[i]) {
+                total += corpus[i].see_ge(move, 0);
+                ops++;
+            }
+        }
+        sink = total;
+        return ops;
+    }));
+
+    results.push_back(measure("is_legal", runs, [&] () {
+        U64 ops = 0, total = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            for (move_t move : pseudo_legal[i]) {
+                total += corpus[i].is_legal(move);
+                ops++;
+            }
+        }
+        sink = total;
+        return ops;
+    }));
+
+    results.push_back(measure("gives_check", runs, [&] () {
+        U64 ops = 0, total = 0;
+        for (size_t i = 0; i < corpus.size(); i++) {
+            for (move_t move : legal[i]) {
+                total += corpus[i].gives_check(move);
+                ops++;
+            }
+        }
+        sink = total;
+        return ops;
+    }));
+
+    // Evaluation: a warm pawn hash already holds every pawn structure in the corpus, a cold one is empty
+    {
+        processed_params_t params = processed_params_t(eval_params_t());
+
+        evaluator_t warm(params, 8 * MB);
+        results.push_back(measure("evaluate (warm pawns)", runs, [&] () {
+            U64 total = 0;
+            for (const board_t &board : corpus) {
+                total += warm.evaluate(board);
+            }
+            sink = total;
+            return corpus.size();
+        }));
+
+        std::unique_ptr<evaluator_t> cold;
+        results.push_back(measure("evaluate (cold pawns)", runs, [&] () {
+            cold = std::make_unique<evaluator_t>(params, 8 * MB);
+        }, [&] () {
+            U64 total = 0;
+            for (const board_t &board : corpus) {
+                total += cold->evaluate(board);
+            }
+            sink = total;
+            return corpus.size();
+        }));
+    }
+
+    // Transposition table, with far more positions than fit in the table
+    {
+        tt::hash_t hash(64 * MB);
+        std::mt19937_64 gen(0);
+        std::vector<U64> keys(1u << 22u);
+        for (U64 &key : keys) key = gen();
+
+        results.push_back(measure("tt save", runs, [&] () {
+            for (size_t i = 0; i < keys.size(); i++) {
+                hash.save(tt::EXACT, keys[i], int(i & 31u), 0, 0, 0, EMPTY_MOVE);
+            }
+            return keys.size();
+        }));
+
+        results.push_back(measure("tt probe", runs, [&] () {
+            U64 total = 0;
+            tt::entry_t entry = {};
+            for (U64 key : keys) {
+                total += hash.probe(key, entry);
+            }
+            sink = total;
+            return keys.size();
+        }));
+    }
+
+    // Slider attacks, for every bishop and rook in the corpus, with each lookup method
+    bool use_pext = bb_sliders::use_pext;
+    std::vector<std::pair<std::string, bool>> methods = {{"magic", false}};
+#ifdef __BMI2__
+    methods.emplace_back("pext", true);
+#endif
+    for (const auto &[method, pext] : methods) {
+        bb_sliders::use_pext = pext;
+
+        results.push_back(measure("find_moves<BISHOP> " + method, runs, [&] () {
+            U64 ops = 0, total = 0;
+            for (const board_t &board : corpus) {
+                U64 occupied = board.all();
+                for (U64 bishops = board.pieces(WHITE, BISHOP) | board.pieces(BLACK, BISHOP)
+                                   | board.pieces(WHITE, QUEEN) | board.pieces(BLACK, QUEEN); bishops;) {
+                    total += find_moves<BISHOP>(WHITE, pop_bit(bishops), occupied);
+                    ops++;
+                }
+            }
+            sink = total;
+            return ops;
+        }));
+
+        results.push_back(measure("find_moves<ROOK> " + method, runs, [&] () {
+            U64 ops = 0, total = 0;
+            for (const board_t &board : corpus) {
+                U64 occupied = board.all();
+                for (U64 rooks = board.pieces(WHITE, ROOK) | board.pieces(BLACK, ROOK)
+                                 | board.pieces(WHITE, QUEEN) | board.pieces(BLACK, QUEEN); rooks;) {
+                    total += find_moves<ROOK>(WHITE, pop_bit(rooks), occupied);
+                    ops++;
+                }
+            }
+            sink = total;
+            return ops;
+        }));
+
+        // Move generation depends heavily on slider lookups
+        results.push_back(measure("gen_normal " + method, runs, [&] () {
+            move_t buf[256];
+            U64 total = 0;
+            for (const board_t &board : corpus) {
+                movegen_t movegen(board, true);
+                total += movegen.gen_normal(buf);
+            }
+            sink = total;
+            return corpus.size();
+        }));
+    }
+    bb_sliders::use_pext = use_pext;
+
+    if (json) {
+        print_json(results);
+    } else {
+        std::cout << corpus.size() << " positions, kernels " << kernel_target() << std::endl;
+        print_text(results);
+    }
+
+    return 0;
+}
@@ -7,24 +7,95 @@
 #include <iterator>
 #include <iostream>
 #include <cstring>
+#include <array>
+#include <algorithm>
 
 #include "board.h"
 #include "move.h"
 #include "hash.h"
 
+namespace {
+    // Castling rights which are lost when a piece moves from or to each square
+    constexpr std::array<uint8_t, 64> castle_rights_lost = [] () {
+        std::array<uint8_t, 64> lost = {};
+        lost[E1] = game_record_t::castle_bit(WHITE, 0) | game_record_t::castle_bit(WHITE, 1);
+        lost[H1] = game_record_t::castle_bit(WHITE, 0);
+        lost[A1] = game_record_t::castle_bit(WHITE, 1);
+        lost[E8] = game_record_t::castle_bit(BLACK, 0) | game_record_t::castle_bit(BLACK, 1);
+        lost[H8] = game_record_t::castle_bit(BLACK, 0);
+        lost[A8] = game_record_t::castle_bit(BLACK, 1);
+        return lost;
+    }();
+}
+
+board_t::board_t(const board_t &board) {
+    *this = board;
+}
+
+board_t &board_t::operator=(const board_t &board) {
+    if (this != &board) copy(board, board.record ? board.history_size() : 0, 0);
+    return *this;
+}
+
+void board_t::copy_recent(const board_t &board, size_t moves) {
+    copy(board, std::min(board.history_size(), size_t(board.now().halfmove_clock) + 1), moves);
+}
+
+void board_t::copy(const board_t &board, size_t records, size_t moves) {
+    std::memcpy(sq_data, board.sq_data, sizeof(sq_data));
+    std::memcpy(bb_pieces, board.bb_pieces, sizeof(bb_pieces));
+    std::memcpy(bb_side, board.bb_side, sizeof(bb_side));
+    bb_all = board.bb_all;
+
+    if (records == 0) {
+        record.reset();
+        top = nullptr;
+        capacity = 0;
+        return;
+    }
+
+    if (capacity < records + moves) {
+        record.reset();
+        capacity = 0;
+        grow(records + moves);
+    }
+
+    std::copy(board.top + 1 - records, board.top + 1, record.get());
+    top = record.get() + records - 1;
+}
+
+void board_t::reserve(size_t moves) {
+    size_t records = record ? history_size() : 0;
+    if (capacity < records + moves) grow(records + moves);
+}
+
+void board_t::grow(size_t new_capacity) {
+    new_capacity = std::max(new_capacity, size_t(16));
+    std::unique_ptr<game_record_t[]> new_record(new game_record_t[new_capacity]);
+
+    size_t records = record ? history_size() : 0;
+    std::copy(record.get(), record.get() + records, new_record.get());
+
+    record = std::move(new_record);
+    top = records ? record.get() + records - 1 : record.get();
+    capacity = new_capacity;
+}
+
 void board_t::move(move_t move) {
-    // Insert a new record
-    record.push_back(record.back());
-    record.back().prev_move = move;
+    // Push a new record
+    if (history_size() == capacity) grow(2 * capacity);
+    top[1] = top[0];
+    top++;
+    top->prev_move = move;
 
     // Update side hash
-    record.back().next_move = (Team) !record.back().next_move;
-    record.back().hash ^= zobrist::side;
+    top->next_move = (Team) !top->next_move;
+    top->hash ^= zobrist::side;
 
     // Update ep hash
-    if (record.crbegin()[1].ep_square != 0) {
-        record.back().ep_square = 0;
-        record.back().hash ^= zobrist::ep[record.crbegin()[1].ep_square];
+    if (top[-1].ep_square != 0) {
+        top->ep_square = 0;
+        top->hash ^= zobrist::ep[top[-1].ep_square];
     }
 
     if (move != EMPTY_MOVE) {
@@ -33,18 +104,18 @@ void board_t::move(move_t move) {
 
         // Update halfmove clock
         if (move.info.piece == PAWN || move.info.is_capture) {
-            record.back().halfmove_clock = 0;
+            top->halfmove_clock = 0;
         } else {
-            record.back().halfmove_clock++;
+            top->halfmove_clock++;
         }
 
-        if (move.info.is_capture && move.info.captured_type == ROOK) {
-            if (move.info.to == (x_team ? H8 : H1) && record.back().castle[x_team][0]) {
-                record.back().castle[x_team][0] = false;
-                record.back().hash ^= zobrist::castle[x_team][0];
-            } else if (move.info.to == (x_team ? A8 : A1) && record.back().castle[x_team][1]) {
-                record.back().castle[x_team][1] = false;
-                record.back().hash ^= zobrist::castle[x_team][1];
+        // Update castling rights, if the king or a rook moves or a rook is captured
+        uint8_t lost_rights = top->castle & (castle_rights_lost[move.info.from] | castle_rights_lost[move.info.to]);
+        if (lost_rights) {
+            top->castle ^= lost_rights;
+            for (; lost_rights; lost_rights &= lost_rights - 1u) {
+                unsigned right = bit_scan(lost_rights);
+                top->hash ^= zobrist::castle[right / 2][right % 2];
             }
         }
 
@@ -66,47 +137,16 @@ void board_t::move(move_t move) {
 
             // Update en-passant square
             if (team ? move.info.to - move.info.from == -16 : move.info.to - move.info.from == 16) {
-                record.back().ep_square = team ? move.info.to + uint8_t(8) : move.info.to - uint8_t(8);
-                record.back().hash ^= zobrist::ep[record.back().ep_square];
+                top->ep_square = team ? move.info.to + uint8_t(8) : move.info.to - uint8_t(8);
+                top->hash ^= zobrist::ep[top->ep_square];
             }
         } else {
-            // Update castling hashes for moving rook
-            if (move.info.piece == ROOK) {
-                if (team) {
-                    if (move.info.from == H8 && record.back().castle[team][0]) {
-                        record.back().hash ^= zobrist::castle[team][0];
-                        record.back().castle[team][0] = false;
-                    } else if (move.info.from == A8 && record.back().castle[team][1]) {
-                        record.back().hash ^= zobrist::castle[team][1];
-                        record.back().castle[team][1] = false;
-                    }
-                } else {
-                    if (move.info.from == H1 && record.back().castle[team][0]) {
-                        record.back().hash ^= zobrist::castle[team][0];
-                        record.back().castle[team][0] = false;
-                    } else if (move.info.from == A1 && record.back().castle[team][1]) {
-                        record.back().hash ^= zobrist::castle[team][1];
-                        record.back().castle[team][1] = false;
-                    }
-                }
-            } else if (move.info.piece == KING) {
-                // Update castling hashes
-                if (record.back().castle[team][0]) {
-                    record.back().hash ^= zobrist::castle[team][0];
-                    record.back().castle[team][0] = false;
-                }
-                if (record.back().castle[team][1]) {
-                    record.back().hash ^= zobrist::castle[team][1];
-                    record.back().castle[team][1] = false;
-                }
-
-                if (move.info.castle) {
-                    // Move rook
-                    switch_piece<true>(team, ROOK,
-                                       move.info.castle_side ? (team ? A8 : A1) : (team ? H8 : H1));
-                    switch_piece<true>(team, ROOK,
-                                       move.info.castle_side ? (team ? D8 : D1) : (team ? F8 : F1));
-                }
+            if (move.info.castle) {
+                // Move rook
+                switch_piece<true>(team, ROOK,
+                                   move.info.castle_side ? (team ? A8 : A1) : (team ? H8 : H1));
+                switch_piece<true>(team, ROOK,
+                                   move.info.castle_side ? (team ? D8 : D1) : (team ? F8 : F1));
             }
 
             if (move.info.is_capture) {
@@ -116,11 +156,13 @@ void board_t::move(move_t move) {
             switch_piece<true>(team, (Piece) move.info.piece, move.info.to);
         }
     }
+
+    update_check_info();
 }
 
 void board_t::unmove() {
-    move_t move = record.back().prev_move;
-    record.pop_back();
+    move_t move = top->prev_move;
+    top--;
 
     if (move != EMPTY_MOVE) {
         if (move.info.piece == PAWN) {
@@ -166,7 +208,8 @@ board_t::board_t(const std::string &fen) {
         throw std::runtime_error("fen: not enough sections: " + std::to_string(split.size()));
     }
 
-    record.emplace_back();
+    grow(16);
+    *top = {};
 
     // Parse board
     uint8_t file = 0, rank = 7;
@@ -198,10 +241,10 @@ board_t::board_t(const std::string &fen) {
 
     // Parse colour
     if (split[1][0] == 'w') {
-        record[0].next_move = WHITE;
+        top->next_move = WHITE;
     } else if (split[1][0] == 'b') {
-        record[0].next_move = BLACK;
-        record[0].hash ^= zobrist::side;
+        top->next_move = BLACK;
+        top->hash ^= zobrist::side;
     } else {
         throw std::runtime_error("fen: invalid team: " + split[1]);
     }
@@ -210,17 +253,17 @@ board_t::board_t(const std::string &fen) {
     if (split[2] != "-") {
         for (char i : split[2]) {
             if (i == 'K') {
-                record[0].castle[WHITE][0] = true;
-                record[0].hash ^= zobrist::castle[WHITE][0];
+                top->castle |= game_record_t::castle_bit(WHITE, 0);
+                top->hash ^= zobrist::castle[WHITE][0];
             } else if (i == 'Q') {
-                record[0].castle[WHITE][1] = true;
-                record[0].hash ^= zobrist::castle[WHITE][1];
+                top->castle |= game_record_t::castle_bit(WHITE, 1);
+                top->hash ^= zobrist::castle[WHITE][1];
             } else if (i == 'k') {
-                record[0].castle[BLACK][0] = true;
-                record[0].hash ^= zobrist::castle[BLACK][0];
+                top->castle |= game_record_t::castle_bit(BLACK, 0);
+                top->hash ^= zobrist::castle[BLACK][0];
             } else if (i == 'q') {
-                record[0].castle[BLACK][1] = true;
-                record[0].hash ^= zobrist::castle[BLACK][1];
+                top->castle |= game_record_t::castle_bit(BLACK, 1);
+                top->hash ^= zobrist::castle[BLACK][1];
             } else {
                 throw std::runtime_error("fen: invalid castling rights: " + std::string(1, i));
             }
@@ -232,18 +275,20 @@ board_t::board_t(const std::string &fen) {
         if (split[3].length() != 2) {
             throw std::runtime_error("en-passant square has invalid length");
         } else {
-            record[0].ep_square = to_sq(split[3][0], split[3][1]);
+            top->ep_square = to_sq(split[3][0], split[3][1]);
         }
     }
 
     // Parse halfmove clock
     if (split.size() > 4) {
-        record[0].halfmove_clock = std::stoi(split[4]);
+        top->halfmove_clock = uint16_t(std::clamp(std::stoi(split[4]), 0, UINT16_MAX));
     } else {
-        record[0].halfmove_clock = 0;
+        top->halfmove_clock = 0;
     }
 
     // Fullmove number is not needed
+
+    update_check_info();
 }
 
 // This does not properly consider legality:
@@ -321,15 +366,15 @@ move_t board_t::to_move(packed_move_t packed_move) const {
     }
 
     // EP
-    move.info.is_capture |= move.info.is_ep = static_cast<uint16_t>(record.back().ep_square != 0
+    move.info.is_capture |= move.info.is_ep = static_cast<uint16_t>(top->ep_square != 0
                                             && move.info.piece == PAWN
-                                            && move.info.to == record.back().ep_square);
+                                            && move.info.to == top->ep_square);
 
     return move;
 }
 
 bool board_t::is_illegal() const {
-    Team side = record.back().next_move;
+    Team side = top->next_move;
     uint8_t king_square = bit_scan(bb_pieces[!side][KING]);
 
     return is_attacked(king_square, side);
@@ -337,10 +382,27 @@ bool board_t::is_illegal() const {
 
 
 bool board_t::is_incheck() const {
-    Team side = record.back().next_move;
-    uint8_t king_square = bit_scan(bb_pieces[side][KING]);
+    return top->checkers != 0;
+}
+
+void board_t::update_check_info() {
+    game_record_t &info = *top;
+    Team side = info.next_move;
 
-    return is_attacked(king_square, Team(!side));
+    info.checkers = bb_pieces[side][KING] ? attacks_to(bit_scan(bb_pieces[side][KING]), side) : 0;
+
+    for (Team team : {WHITE, BLACK}) {
+        info.blockers[team] = 0;
+        if (!bb_pieces[team][KING]) continue;
+
+        uint8_t king_square = bit_scan(bb_pieces[team][KING]);
+        U64 snipers = (find_moves<BISHOP>(team, king_square, 0) & (bb_pieces[!team][BISHOP] | bb_pieces[!team][QUEEN]))
+                      | (find_moves<ROOK>(team, king_square, 0) & (bb_pieces[!team][ROOK] | bb_pieces[!team][QUEEN]));
+        while (snipers) {
+            U64 between = bits_between(king_square, pop_bit(snipers)) & bb_all;
+            if (!multiple_bits(between)) info.blockers[team] |= between;
+        }
+    }
 }
 
 template<bool HASH>
@@ -361,10 +423,10 @@ void board_t::switch_piece(Team side, Piece piece, uint8_t sq) {
 
     if (HASH) { // Update hash
         U64 square_hash = zobrist::squares[sq][side][piece];
-        record.back().hash ^= square_hash;
-        if(piece == PAWN || piece == KING) record.back().kp_hash ^= square_hash;
-        if(sq_data[sq].occupied()) record.back().material.inc(side, piece);
-        else record.back().material.dec(side, piece);
+        top->hash ^= square_hash;
+        if(piece == PAWN || piece == KING) top->kp_hash ^= square_hash;
+        if(sq_data[sq].occupied()) top->material.inc(side, piece);
+        else top->material.dec(side, piece);
     }
 }
 
@@ -403,10 +465,10 @@ bool board_t::is_pseudo_legal(move_t move) const {
     auto team = Team(move.info.team);
     auto x_team = Team(!move.info.team);
 
-    if (record.back().next_move != team) return false;
+    if (top->next_move != team) return false;
 
     if (move.info.castle) {
-        if (record.back().castle[move.info.team][move.info.castle_side] == 0) return false;
+        if (!top->can_castle(Team(move.info.team), move.info.castle_side)) return false;
         if (move.info.castle_side == 0) {
             return (bb_all & bits_between(team ? E8 : E1, team ? H8 : H1)) == 0 &&
                    !is_attacked(team ? E8 : E1, x_team) &&
@@ -427,7 +489,7 @@ bool board_t::is_pseudo_legal(move_t move) const {
     }
 
     if(move.info.is_ep) {
-        if(record.back().ep_square == 0 || move.info.to != record.back().ep_square) {
+        if(top->ep_square == 0 || move.info.to != top->ep_square) {
             return false;
         }
     } else {
@@ -451,52 +513,30 @@ bool board_t::is_legal(move_t move) const {
     Team side = Team(move.info.team);
     Team x_side = Team(!side);
     uint8_t king_square = bit_scan(bb_pieces[side][KING]);
+    U64 checkers = top->checkers;
 
-    U64 checkers = attacks_to(king_square, side);
-    if(checkers != 0) {
-        if(move.info.piece == KING) {
-            U64 occupied = bb_all ^ single_bit(move.info.from);
-            if(!move.info.is_capture) occupied ^= single_bit(move.info.to);
+    if (move.info.piece == KING) {
+        return !is_attacked(move.info.to, x_side, bb_all ^ single_bit(move.info.from));
+    }
 
-            return !is_attacked(move.info.to, x_side, occupied);
-        } else {
-            U64 occupied = bb_all ^ single_bit(move.info.from);
-            if(move.info.is_ep) {
-                if((checkers ^ single_bit(uint8_t(rel_offset(Team(move.info.team), D_S) + move.info.to))) == 0) {
-                    occupied ^= single_bit(uint8_t(rel_offset(Team(move.info.team), D_S) + move.info.to))
-                            | single_bit(move.info.to);
-                    return !(find_moves<BISHOP>(side, king_square, occupied) & (bb_pieces[x_side][BISHOP] | bb_pieces[x_side][QUEEN]))
-                           && !(find_moves<ROOK>(side, king_square, occupied) & (bb_pieces[x_side][ROOK] | bb_pieces[x_side][QUEEN]));
-                } else {
-                    return false;
-                }
-            } if(move.info.is_capture && (checkers ^ single_bit(move.info.to)) == 0) {
-                return !(find_moves<BISHOP>(side, king_square, occupied) & (bb_pieces[x_side][BISHOP] | bb_pieces[x_side][QUEEN]) & ~checkers)
-                       && !(find_moves<ROOK>(side, king_square, occupied) & (bb_pieces[x_side][ROOK] | bb_pieces[x_side][QUEEN]) & ~checkers);
-            } else {
-                occupied ^= single_bit(move.info.to);
-                return !is_attacked(king_square, x_side, occupied);
-            }
-        }
-    } else {
-        if(move.info.piece == KING) {
-            return !is_attacked(move.info.to, x_side);
-        } else {
-            U64 occupied = bb_all ^ single_bit(move.info.from);
-            U64 captured = 0;
-            if (move.info.is_ep) {
-                occupied ^= single_bit(uint8_t(rel_offset(Team(move.info.team), D_S) + move.info.to));
-                occupied ^= single_bit(move.info.to);
-            } else if (!move.info.is_capture) {
-                occupied ^= single_bit(move.info.to);
-            } else {
-                captured ^= single_bit(move.info.to);
-            }
+    if (move.info.is_ep) {
+        // The captured pawn may have been blocking an attack, or giving check itself
+        U64 captured = single_bit(uint8_t(rel_offset(side, D_S) + move.info.to));
+        U64 occupied = bb_all ^ single_bit(move.info.from) ^ captured ^ single_bit(move.info.to);
+        return !(checkers & ~captured & (bb_pieces[x_side][KNIGHT] | bb_pieces[x_side][PAWN]))
+               && !(find_moves<BISHOP>(side, king_square, occupied) & (bb_pieces[x_side][BISHOP] | bb_pieces[x_side][QUEEN]))
+               && !(find_moves<ROOK>(side, king_square, occupied) & (bb_pieces[x_side][ROOK] | bb_pieces[x_side][QUEEN]));
+    }
 
-            return !(find_moves<BISHOP>(side, king_square, occupied) & (bb_pieces[x_side][BISHOP] | bb_pieces[x_side][QUEEN]) & ~captured)
-                && !(find_moves<ROOK>(side, king_square, occupied) & (bb_pieces[x_side][ROOK] | bb_pieces[x_side][QUEEN]) & ~captured);
-        }
+    // Other pieces must capture or block a single checker
+    if (checkers) {
+        if (multiple_bits(checkers)) return false;
+        if (!((checkers | bits_between(king_square, bit_scan(checkers))) & single_bit(move.info.to))) return false;
     }
+
+    // Pinned pieces must stay on the line between their king and the pinner
+    return !(top->blockers[side] & single_bit(move.info.from))
+           || (line(king_square, move.info.from) & single_bit(move.info.to));
 }
 
 // Assumes the move is both pseudo legal and legal
@@ -504,38 +544,56 @@ bool board_t::gives_check(move_t move) const {
     Team side = Team(move.info.team);
     Team x_side = Team(!move.info.team);
     uint8_t king_square = bit_scan(bb_pieces[x_side][KING]);
+    const game_record_t &info = *top;
 
-    if(find_moves(Piece(move.info.piece), side, move.info.to, bb_all) & bb_pieces[x_side][KING]) {
+    if (!move.info.is_promotion && (check_squares(Piece(move.info.piece)) & single_bit(move.info.to))) {
+        return true;
+    } else if ((info.blockers[x_side] & single_bit(move.info.from))
+               && !(line(king_square, move.info.from) & single_bit(move.info.to))) {
+        // Discovered check
         return true;
     } else if(move.info.castle) {
         U64 occupied = bb_all ^ single_bit(move.info.from) ^ single_bit(move.info.to);
         return (find_moves<ROOK>(side,
                                  side ? (move.info.castle_side ? D8 : F8) : (move.info.castle_side ? D1 : F1), occupied)
                 & bb_pieces[x_side][KING]) != 0;
-    } else if (move.info.is_promotion && (find_moves(Piece(move.info.promotion_type), side, move.info.to,
-            (bb_all ^ single_bit(move.info.from)) | single_bit(move.info.to)) & bb_pieces[x_side][KING])) {
-        return true;
-    } else {
-        U64 occupied = bb_all ^ single_bit(move.info.from);
-        if (move.info.is_ep) {
-            occupied ^= single_bit(uint8_t(rel_offset(Team(move.info.team), D_S) + move.info.to));
-            occupied ^= single_bit(move.info.to);
-        } else if (!move.info.is_capture) {
-            occupied ^= single_bit(move.info.to);
-        }
+    } else if (move.info.is_promotion) {
+        return (find_moves(Piece(move.info.promotion_type), side, move.info.to,
+                           (bb_all ^ single_bit(move.info.from)) | single_bit(move.info.to)) & bb_pieces[x_side][KING]) != 0;
+    } else if (move.info.is_ep) {
+        // The captured pawn may uncover an attack
+        U64 occupied = bb_all ^ single_bit(move.info.from) ^ single_bit(move.info.to)
+                       ^ single_bit(uint8_t(rel_offset(Team(move.info.team), D_S) + move.info.to));
 
         return (find_moves<BISHOP>(x_side, king_square, occupied) & (bb_pieces[side][BISHOP] | bb_pieces[side][QUEEN]))
                || (find_moves<ROOK>(x_side, king_square, occupied) & (bb_pieces[side][ROOK] | bb_pieces[side][QUEEN]));
     }
+
+    return false;
+}
+
+U64 board_t::check_squares(Piece piece) const {
+    Team x_side = Team(!top->next_move);
+    uint8_t king_square = bit_scan(bb_pieces[x_side][KING]);
+
+    switch (piece) {
+        case PAWN:
+            return pawn_caps(x_side, king_square);
+        case KING:
+            return 0;
+        default:
+            return find_moves(piece, x_side, king_square, bb_all);
+    }
 }
 
 bool board_t::is_repetition_draw(int search_ply) const {
     int rep = 1;
 
-    int max = record.back().halfmove_clock;
+    // The history may be shorter than the halfmove clock, e.g. after setting up a position from FEN
+    int max = std::min(int(top->halfmove_clock), int(history_size()) - 1);
 
     for (int i = 2; i <= max; i += 2) {
-        if (record.crbegin()[i].hash == record.back().hash) rep++;
+        if (top[-i].hash == top->hash) rep++;
         if (rep >= 3) return true;
         if (rep >= 2 && i < search_ply) return true;
     }
@@ -544,38 +602,35 @@ bool board_t::is_repetition_draw(int search_ply) const {
 }
 
 bool board_t::is_material_draw() const {
-    if(record.back().material.count(WHITE, PAWN) || record.back().material.count(BLACK, PAWN) ||
-            record.back().material.count(WHITE, QUEEN) || record.back().material.count(BLACK, QUEEN) ||
-            record.back().material.count(WHITE, ROOK) || record.back().material.count(BLACK, ROOK)) {
+    if(top->material.count(WHITE, PAWN) || top->material.count(BLACK, PAWN) ||
+            top->material.count(WHITE, QUEEN) || top->material.count(BLACK, QUEEN) ||
+            top->material.count(WHITE, ROOK) || top->material.count(BLACK, ROOK)) {
         return false;
     } else {
-        return record.back().material.count(WHITE, BISHOP) + record.back().material.count(BLACK, BISHOP)
-               + record.back().material.count(WHITE, KNIGHT) + record.back().material.count(BLACK, KNIGHT) <= 1;
+        return top->material.count(WHITE, BISHOP) + top->material.count(BLACK, BISHOP)
+               + top->material.count(WHITE, KNIGHT) + top->material.count(BLACK, KNIGHT) <= 1;
     }
 }
 
 void board_t::mirror() {
     // Mirror side
-    record.back().next_move = (Team) !record.back().next_move;
-    record.back().hash ^= zobrist::side;
+    top->next_move = (Team) !top->next_move;
+    top->hash ^= zobrist::side;
 
     // Mirror en-passant
-    if (record.back().ep_square != 0) {
-        record.back().hash ^= zobrist::ep[record.back().ep_square];
-        record.back().ep_square = rel_sq(BLACK, record.back().ep_square);
-        record.back().hash ^= zobrist::ep[record.back().ep_square];
+    if (top->ep_square != 0) {
+        top->hash ^= zobrist::ep[top->ep_square];
+        top->ep_square = rel_sq(BLACK, top->ep_square);
+        top->hash ^= zobrist::ep[top->ep_square];
     }
 
     // Mirror castling rights
-    if(record.back().castle[0][0] != record.back().castle[1][0]) {
-        record.back().hash ^= zobrist::castle[0][0];
-        record.back().hash ^= zobrist::castle[1][0];
-        std::swap(record.back().castle[0][0], record.back().castle[1][0]);
-    }
-    if(record.back().castle[0][1] != record.back().castle[1][1]) {
-        record.back().hash ^= zobrist::castle[0][1];
-        record.back().hash ^= zobrist::castle[1][1];
-        std::swap(record.back().castle[0][1], record.back().castle[1][1]);
+    for (int side = 0; side < 2; side++) {
+        if(top->can_castle(WHITE, side) != top->can_castle(BLACK, side)) {
+            top->hash ^= zobrist::castle[WHITE][side];
+            top->hash ^= zobrist::castle[BLACK][side];
+            top->castle ^= game_record_t::castle_bit(WHITE, side) | game_record_t::castle_bit(BLACK, side);
+        }
     }
 
     // Mirror pieces
@@ -587,6 +642,8 @@ void board_t::mirror() {
     for (uint8_t sq = 0; sq < 64; sq++) {
         if(old_data[sq].occupied()) switch_piece<true>(Team(!old_data[sq].team()), old_data[sq].piece(), rel_sq(BLACK, sq));
     }
+
+    update_check_info();
 }
 
 int board_t::see(move_t move) const {
@@ -618,35 +675,13 @@ int board_t::see(move_t move) const {
     occupation_mask &= ~single_bit(move.info.from);
 
     // Reveal next attacker
-    attackers |= (find_moves<QUEEN>(next_move, move.info.to, bb_all & occupation_mask)
-                  & (bb_pieces[WHITE][QUEEN] | bb_pieces[BLACK][QUEEN])) |
-                 (find_moves<BISHOP>(next_move, move.info.to, bb_all & occupation_mask)
-                  & (bb_pieces[WHITE][BISHOP] | bb_pieces[BLACK][BISHOP])) |
-                 (find_moves<ROOK>(next_move, move.info.to, bb_all & occupation_mask)
-                  & (bb_pieces[WHITE][ROOK] | bb_pieces[BLACK][ROOK]));
+    attackers |= see_xrays(move.info.to, bb_all & occupation_mask);
     attackers &= occupation_mask;
 
     next_move = Team(!next_move);
 
-    while (attackers) {
-        // Pick LVA
-        Square from;
-        if (!prom_rank && attackers & bb_pieces[next_move][PAWN])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][PAWN]));
-        else if (attackers & bb_pieces[next_move][KNIGHT])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][KNIGHT]));
-        else if (attackers & bb_pieces[next_move][BISHOP])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][BISHOP]));
-        else if (attackers & bb_pieces[next_move][ROOK])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][ROOK]));
-        else if (prom_rank && attackers & bb_pieces[next_move][PAWN])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][PAWN]));
-        else if (attackers & bb_pieces[next_move][QUEEN])
-            from = Square(bit_scan(attackers & bb_pieces[next_move][QUEEN]));
-        else if (attackers & bb_pieces[next_move][KING] && !(attackers & bb_side[!next_move]))
-            from = Square(bit_scan(attackers & bb_pieces[next_move][KING]));
-        else break;
-
+    Square from;
+    while (see_lva(attackers, next_move, prom_rank, from)) {
         // Eval move
         material[num_capts] = -material[num_capts - 1] + current_target_val;
         current_target_val = VAL[sq_data[from].piece()];
@@ -661,12 +696,7 @@ int board_t::see(move_t move) const {
         occupation_mask &= ~single_bit(from);
 
         // Reveal next attacker
-        attackers |= (find_moves<QUEEN>(next_move, move.info.to, bb_all & occupation_mask)
-                      & (bb_pieces[WHITE][QUEEN] | bb_pieces[BLACK][QUEEN])) |
-                     (find_moves<BISHOP>(next_move, move.info.to, bb_all & occupation_mask)
-                      & (bb_pieces[WHITE][BISHOP] | bb_pieces[BLACK][BISHOP])) |
-                     (find_moves<ROOK>(next_move, move.info.to, bb_all & occupation_mask)
-                      & (bb_pieces[WHITE][ROOK] | bb_pieces[BLACK][ROOK]));
+        attackers |= see_xrays(move.info.to, bb_all & occupation_mask);
         attackers &= occupation_mask;
 
         next_move = Team(!next_move);
@@ -680,6 +710,97 @@ int board_t::see(move_t move) const {
     return material[0];
 }
 
+bool board_t::see_ge(move_t move, int threshold) const {
+    if(move == EMPTY_MOVE || move.info.is_ep)
+        return 0 >= threshold;
+
+    bool prom_rank = rank_index(move.info.to) == 0 || rank_index(move.info.to) == 7;
+
+    // Material balance for the side which made the last capture, if the exchange were to stop there
+    int balance = sq_data[move.info.to].occupied() ? VAL[sq_data[move.info.to].piece()] : 0;
+    int current_target_val = VAL[move.info.piece];
+    if (prom_rank && move.info.piece == PAWN) {
+        balance += VAL[move.info.promotion_type] - VAL[PAWN];
+        current_target_val += VAL[move.info.promotion_type] - VAL[PAWN];
+    }
+
+    // Each side can stop capturing, so the first side can't do better than the balance after its own capture, and
+    // can't do worse than losing the capturing piece unless a recapture promotes.
+    if (balance < threshold) return false;
+    if (!prom_rank && balance - current_target_val >= threshold) return true;
+
+    // State
+    U64 attackers = attacks_to(move.info.to, Team(move.info.team)) | attacks_to(move.info.to, Team(!move.info.team));
+    U64 occupation_mask = ONES;
+    auto next_move = Team(move.info.team);
+
+    // Remove attacker
+    attackers &= ~single_bit(move.info.from);
+    occupation_mask &= ~single_bit(move.info.from);
+
+    // Reveal next attacker
+    attackers |= see_xrays(move.info.to, bb_all & occupation_mask);
+    attackers &= occupation_mask;
+
+    next_move = Team(!next_move);
+
+    bool ours = true; // Whether the last capture was made by the side which made the first capture
+    Square from;
+    while (see_lva(attackers, next_move, prom_rank, from)) {
+        balance = -balance + current_target_val;
+        current_target_val = VAL[sq_data[from].piece()];
+        if (prom_rank && sq_data[from].piece() == PAWN) {
+            balance += VAL[QUEEN] - VAL[PAWN];
+            current_target_val = VAL[QUEEN] - VAL[PAWN];
+        }
+        ours = !ours;
+
+        // Stop as soon as the side which just captured can settle the result by stopping the exchange
+        if (ours && balance < threshold) return false;
+        if (!ours && -balance >= threshold) return true;
+
+        // Remove attacker
+        attackers &= ~single_bit(from);
+        occupation_mask &= ~single_bit(from);
+
+        // Reveal next attacker
+        attackers |= see_xrays(move.info.to, bb_all & occupation_mask);
+        attackers &= occupation_mask;
+
+        next_move = Team(!next_move);
+    }
+
+    return ours;
+}
+
+bool board_t::see_lva(U64 attackers, Team side, bool prom_rank, Square &from) const {
+    // Pawns capturing onto the last rank promote, so they are treated as more valuable than rooks
+    if (!prom_rank && attackers & bb_pieces[side][PAWN])
+        from = Square(bit_scan(attackers & bb_pieces[side][PAWN]));
+    else if (attackers & bb_pieces[side][KNIGHT])
+        from = Square(bit_scan(attackers & bb_pieces[side][KNIGHT]));
+    else if (attackers & bb_pieces[side][BISHOP])
+        from = Square(bit_scan(attackers & bb_pieces[side][BISHOP]));
+    else if (attackers & bb_pieces[side][ROOK])
+        from = Square(bit_scan(attackers & bb_pieces[side][ROOK]));
+    else if (prom_rank && attackers & bb_pieces[side][PAWN])
+        from = Square(bit_scan(attackers & bb_pieces[side][PAWN]));
+    else if (attackers & bb_pieces[side][QUEEN])
+        from = Square(bit_scan(attackers & bb_pieces[side][QUEEN]));
+    else if (attackers & bb_pieces[side][KING] && !(attackers & bb_side[!side]))
+        from = Square(bit_scan(attackers & bb_pieces[side][KING]));
+    else return false;
+
+    return true;
+}
+
+U64 board_t::see_xrays(uint8_t sq, U64 occupied) const {
+    return (find_moves<BISHOP>(WHITE, sq, occupied)
+            & (bb_pieces[WHITE][BISHOP] | bb_pieces[BLACK][BISHOP] | bb_pieces[WHITE][QUEEN] | bb_pieces[BLACK][QUEEN]))
+           | (find_moves<ROOK>(WHITE, sq, occupied)
+              & (bb_pieces[WHITE][ROOK] | bb_pieces[BLACK][ROOK] | bb_pieces[WHITE][QUEEN] | bb_pieces[BLACK][QUEEN]));
+}
+
 U64 board_t::non_pawn_material(Team side) const {
     return (bb_side[side] ^ bb_pieces[side][PAWN] ^ bb_pieces[side][KING]);
 }
@@ -8,6 +8,7 @@
 #include <string>
 #include <iostream>
 #include <vector>
+#include <memory>
 
 #include "move.h"
 #include "types.h"
@@ -16,17 +17,37 @@
 
 /**
  * Represents a state in the game. It contains the move used to reach the state, and necessary variables within the state.
+ * Exactly one cache line, so that copying a record on every move touches as little memory as possible.
  */
-struct game_record_t {
-    move_t prev_move; // Last move before this position - can be EMPTY_MOVE
-    Team next_move; // Who moves next?
-    bool castle[2][2]; // castling rights for [team][kingside, queenside]
-    uint8_t ep_square; // Target square for en-passant after last double pawn move
-    int halfmove_clock; // Moves since last pawn move or capture
+struct alignas(64) game_record_t {
     U64 hash; // Zobrist hash of current position
     U64 kp_hash; // Zobrist hash of only king and pawns in current position
     material_data_t material; // Material counts in current position
+
+    // Check information, computed once per position
+    U64 checkers; // Enemy pieces giving check to the side to move
+    U64 blockers[2]; // Pieces of either side which are the only piece between [team]'s king and an enemy slider
+
+    move_t prev_move; // Last move before this position - can be EMPTY_MOVE
+    uint16_t halfmove_clock; // Moves since last pawn move or capture
+    uint8_t ep_square; // Target square for en-passant after last double pawn move
+    Team next_move : 1; // Who moves next?
+    uint8_t castle : 4; // Castling rights, bit 2 * team + side is set if [team] can castle [kingside, queenside]
+
+    /**
+     * @param team team to check
+     * @param side 0 for kingside, 1 for queenside
+     * @return bit representing the castling right of the given team and side
+     */
+    static constexpr uint8_t castle_bit(Team team, int side) {
+        return uint8_t(1u << (2u * team + side));
+    }
+
+    [[nodiscard]] constexpr bool can_castle(Team team, int side) const {
+        return castle & castle_bit(team, side);
+    }
 };
+static_assert(sizeof(game_record_t) == 64);
 
 /**
  * Represents the attacks on a certain square on the board. The team and piece fields are only meaningful if the
@@ -45,13 +66,19 @@ public:
 static_assert(sizeof(sq_data_t) == 1);
 
 /**
- * Topple Board Representation. Uses a square array, multiple bitboards, and a history vector.
+ * Topple Board Representation. Uses a square array, multiple bitboards, and a stack of game records.
  */
 class alignas(64) board_t {
 public:
     // Leaves the board in an empty, inconsistent state - used to construct a board to be assigned to later
     board_t() = default;
 
+    // Copying a board copies its history, but not the spare capacity of the record stack
+    board_t(const board_t &board);
+    board_t &operator=(const board_t &board);
+    board_t(board_t &&board) noexcept = default;
+    board_t &operator=(board_t &&board) noexcept = default;
+
     /**
      * Construct a board from a string in Forsyth–Edwards Notation.
      * e.g. rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1
@@ -68,12 +95,12 @@ public:
      *
      * @param move move to make
      */
-    void move(move_t move);
+    TOPPLE_HOT void move(move_t move);
 
     /**
      * Undo the previous move. Undefined behaviour if no previous move exists.
      */
-    void unmove();
+    TOPPLE_HOT void unmove();
 
     /**
      * Parses a move given in long algebraic notation in the context of this position. The same string may refer to
@@ -148,7 +175,7 @@ public:
      * @param move move to check
      * @return true if the move is pseudo-legal
      */
-    [[nodiscard]] bool is_pseudo_legal(move_t move) const;
+    [[nodiscard]] TOPPLE_HOT bool is_pseudo_legal(move_t move) const;
 
     /**
      * Checks if a pseudo-legal move is legal: that the move does not leave the side
@@ -158,7 +185,7 @@ public:
      * @param move move to check
      * @return true if the move is legal, false otherwise
      */
-    [[nodiscard]] bool is_legal(move_t move) const;
+    [[nodiscard]] TOPPLE_HOT bool is_legal(move_t move) const;
 
     /**
      * Checks if a pseudo-legal move gives check. Unspecified return value if the move is
@@ -167,7 +194,16 @@ public:
      * @param move move to check
      * @return true if the move gives check, false otherwise
      */
-    [[nodiscard]] bool gives_check(move_t move) const;
+    [[nodiscard]] TOPPLE_HOT bool gives_check(move_t move) const;
+
+    /**
+     * Finds the squares from which a piece of the side to move would attack the enemy king. These are computed when
+     * needed rather than stored in the game record, which would no longer fit in a cache line.
+     *
+     * @param piece type of the piece
+     * @return bitboard of squares from which the piece would give direct check
+     */
+    [[nodiscard]] U64 check_squares(Piece piece) const;
 
     /**
      * Checks if the current position is a draw by threefold repetition, given that the position
@@ -195,7 +231,17 @@ public:
      * @param move move to evaluate
      * @return static exchange evaluation
      */
-    [[nodiscard]] int see(move_t move) const;
+    [[nodiscard]] TOPPLE_HOT int see(move_t move) const;
+
+    /**
+     * Checks if the static exchange evaluation of the given move is at least the threshold. Equivalent to
+     * see(move) >= threshold, but stops as soon as the result is known.
+     *
+     * @param move move to evaluate
+     * @param threshold threshold to compare against
+     * @return true if see(move) >= threshold
+     */
+    [[nodiscard]] TOPPLE_HOT bool see_ge(move_t move, int threshold) const;
 
     /**
      * Finds the set of pieces of side excluding pawns and kings. Equivalent to:
@@ -211,6 +257,23 @@ public:
      */
     void mirror();
 
+    /**
+     * Reserve space in the game history, so that making up to {@code moves} further moves does not allocate.
+     *
+     * @param moves number of moves to make room for
+     */
+    void reserve(size_t moves);
+
+    /**
+     * Copy a position into this board, with only the part of its history which can affect repetition detection, and
+     * room for {@code moves} further moves. Reuses the record stack of this board if it is large enough, so that
+     * copying the root position into a search thread is cheap however long the game is.
+     *
+     * @param board position to copy
+     * @param moves number of moves to make room for
+     */
+    void copy_recent(const board_t &board, size_t moves);
+
     // Accessors (all const)
 
     [[nodiscard]] inline U64 pieces(Team team, Piece piece) const { return bb_pieces[team][piece]; }
@@ -218,8 +281,9 @@ public:
     [[nodiscard]] inline U64 all() const { return bb_all; }
     [[nodiscard]] inline sq_data_t sq(uint8_t sq) const { return sq_data[sq]; }
     [[nodiscard]] inline sq_data_t sq(uint8_t file, uint8_t rank) const { return sq_data[square_index(file, rank)]; }
-    [[nodiscard]] inline std::vector<game_record_t> const& history() const { return record; }
-    [[nodiscard]] inline game_record_t const& now() const { return record.back(); }
+    [[nodiscard]] inline size_t history_size() const { return top - record.get() + 1; }
+    [[nodiscard]] inline game_record_t const& history(size_t i) const { return record[i]; }
+    [[nodiscard]] inline game_record_t const& now() const { return *top; }
 private:
     // Square array
     sq_data_t sq_data[64] = {{}};
@@ -229,8 +293,16 @@ private:
     U64 bb_side[2] = {}; // [Team]
     U64 bb_all = {}; // All occupied squares
 
-    /* Game history */
-    std::vector<game_record_t> record;
+    /* Game history: a stack of records, with the current position on top */
+    std::unique_ptr<game_record_t[]> record;
+    game_record_t *top = nullptr;
+    size_t capacity = 0;
+
+    // Replace the record stack with a larger one, keeping the history
+    void grow(size_t new_capacity);
+
+    // Copy the position and the last {@code records} records of another board, with room for {@code moves} more
+    void copy(const board_t &board, size_t records, size_t moves);
 
     // Toggle the presence of a piece on a particular square.
     // Unsafe - only has consistent behaviour if the piece is present on the square, or the square is empty
@@ -238,6 +310,13 @@ private:
     template<bool HASH>
     void switch_piece(Team side, Piece piece, uint8_t sq);
 
+    // Compute the check information in the current record
+    void update_check_info();
+
+    // Static exchange evaluation helpers: find the least valuable attacker of side, and the sliders attacking sq
+    bool see_lva(U64 attackers, Team side, bool prom_rank, Square &from) const;
+    [[nodiscard]] U64 see_xrays(uint8_t sq, U64 occupied) const;
+
     // std::cout << *this
     void print();
 };
@@ -245,12 +324,12 @@ private:
 inline std::ostream &operator<<(std::ostream &stream, const board_t &board) {
     stream << std::endl;
 
-    for (int i = 1; i <= board.history().size(); i++) {
+    for (size_t i = 1; i < board.history_size(); i++) {
         if (i % 2 != 0) {
             stream << " " << ((i + 1) / 2) << ". ";
         }
 
-        stream << board.history()[i].prev_move << " ";
+        stream << board.history(i).prev_move << " ";
     }
 
     stream << std::endl;
@@ -99,6 +99,14 @@ processed_params_t::processed_params_t(const eval_params_t &params)
 /// Main evaluation functions
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
+eval_cache_t::eval_cache_t(size_t size) {
+    resize(size);
+}
+
+void eval_cache_t::resize(size_t size) {
+    table.assign(size / sizeof(U64), 0);
+}
+
 evaluator_t::evaluator_t(const processed_params_t &params, size_t pawn_hash_size) : params(params) {
     // Set up pawn hash table
     pawn_hash_size /= sizeof(pawns::structure_t);
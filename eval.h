@@ -240,6 +240,70 @@ struct processed_params_t : public eval_params_t {
     v4si_t kat_table[128] = {};
 };
 
+/**
+ * A direct-mapped cache of static evaluations, keyed by the Zobrist hash of the position. Each search thread
+ * has its own cache, so entries are plain 64 bit words: the low 48 bits of the hash, and a 16 bit evaluation.
+ */
+class eval_cache_t {
+    std::vector<U64> table;
+
+    // Statistics
+    U64 hits = 0;
+    U64 probes = 0;
+public:
+    /**
+     * Construct a new evaluation cache with the given size in bytes. A size of 0 disables the cache.
+     *
+     * @param size size of the cache in bytes
+     */
+    explicit eval_cache_t(size_t size);
+
+    /**
+     * Resize and clear the cache
+     *
+     * @param size new size of the cache in bytes
+     */
+    void resize(size_t size);
+
+    /**
+     * Look up the evaluation of a position
+     *
+     * @param hash hash of the position
+     * @param eval set to the cached evaluation on a hit
+     * @return true on hit, false otherwise
+     */
+    bool probe(U64 hash, int &eval) {
+        if (table.empty()) return false;
+
+        probes++;
+        U64 entry = table[tt::bucket_index(hash, table.size())];
+        if ((entry >> 16u) == (hash & 0xFFFFFFFFFFFFull)) {
+            hits++;
+            eval = int16_t(entry & 0xFFFFu);
+            return true;
+        }
+
+        return false;
+    }
+
+    /**
+     * Store the evaluation of a position, replacing any other position in the same slot
+     *
+     * @param hash hash of the position
+     * @param eval evaluation of the position
+     */
+    void save(U64 hash, int eval) {
+        if (table.empty()) return;
+
+        table[tt::bucket_index(hash, table.size())] = (hash << 16u) | uint16_t(int16_t(eval));
+    }
+
+    // Statistics
+    [[nodiscard]] U64 get_hits() const { return hits; }
+    [[nodiscard]] U64 get_probes() const { return probes; }
+    void reset_stats() { hits = probes = 0; }
+};
+
 class alignas(64) evaluator_t {
     pawns::structure_t *pawn_hash_table;
     size_t pawn_hash_entries;
@@ -264,7 +328,7 @@ public:
      * @param board position to evaluate
      * @return evaluation in centipawns.
      */
-    int evaluate(const board_t &board);
+    TOPPLE_HOT int evaluate(const board_t &board);
 
     /**
      * Prefetch an entry in the pawn hash table
@@ -304,13 +368,13 @@ private:
         }
     };
 
-    v4si_t eval_pawns(const board_t &board, eval_data_t &data, float &taper);
+    TOPPLE_HOT v4si_t eval_pawns(const board_t &board, eval_data_t &data, float &taper);
 
-    v4si_t eval_pieces(const board_t &board, eval_data_t &data);
+    TOPPLE_HOT v4si_t eval_pieces(const board_t &board, eval_data_t &data);
 
-    v4si_t eval_threats(const board_t &board, eval_data_t &data);
+    TOPPLE_HOT v4si_t eval_threats(const board_t &board, eval_data_t &data);
 
-    v4si_t eval_positional(const board_t &board, eval_data_t &data);
+    TOPPLE_HOT v4si_t eval_positional(const board_t &board, eval_data_t &data);
 };
 
 #endif //TOPPLE_EVAL_H
@@ -5,47 +5,322 @@
 #include <random>
 #include <memory>
 #include <cstring>
+#include <climits>
+#include <sstream>
+#include <fstream>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/mempolicy.h>
+#endif
+
 #include "hash.h"
 
-tt::hash_t::hash_t(size_t size) {
-    // Divide size by the sizeof an entry
-    size /= (sizeof(tt::entry_t) * bucket_size);
-    size = lower_power_of_2(size);
-    if (size < sizeof(tt::entry_t)) {
-        num_entries = 0;
-    } else {
-        num_entries = size - 1;
-        table = new tt::entry_t[num_entries * bucket_size + bucket_size]();
+#ifdef TOPPLE_TT_STATS
+#define TT_STAT(statement) statement
+#else
+#define TT_STAT(statement)
+#endif
+
+namespace {
+    // Snapshots begin with a header padded to a page, followed by the raw buckets
+    constexpr char snapshot_magic[8] = {'T', 'O', 'P', 'P', 'L', 'E', 'T', 'T'};
+    constexpr uint32_t snapshot_version = 2; // Version 2 stores depths offset by DEPTH_OFFSET
+    constexpr size_t snapshot_offset = 4096;
+
+    struct snapshot_header_t {
+        char magic[8];
+        uint32_t version;
+        uint32_t bucket_entries;
+        uint64_t num_buckets;
+        uint32_t generation;
+    };
+    static_assert(sizeof(snapshot_header_t) <= snapshot_offset);
+
+#ifdef TOPPLE_TT_STATS
+    std::mutex stats_mtx;
+    std::vector<tt::stats_t *> live_stats;
+    tt::stats_t retired_stats;
+
+    // Counters for the current thread, registered for as long as the thread exists
+    struct thread_stats_t {
+        tt::stats_t stats;
+
+        thread_stats_t() {
+            std::lock_guard<std::mutex> lock(stats_mtx);
+            live_stats.push_back(&stats);
+        }
+
+        ~thread_stats_t() {
+            std::lock_guard<std::mutex> lock(stats_mtx);
+            retired_stats += stats;
+            live_stats.erase(std::find(live_stats.begin(), live_stats.end(), &stats));
+        }
+    };
+
+    thread_local thread_stats_t local;
+#endif
+
+#ifdef __linux__
+    constexpr size_t huge_page_size = 2 * MB;
+
+    // Set the memory policy of a fresh mapping to interleave its pages across all online NUMA nodes.
+    // This must happen before the pages are first touched.
+    void interleave(void *mem, size_t bytes) {
+        std::ifstream online("/sys/devices/system/node/online");
+        std::string ranges;
+        if (!(online >> ranges)) return;
+
+        // Parse a node list, e.g. "0-1,4"
+        unsigned long node_mask = 0;
+        std::istringstream iss(ranges);
+        std::string range;
+        while (std::getline(iss, range, ',')) {
+            size_t dash = range.find('-');
+            unsigned first = std::stoul(range.substr(0, dash));
+            unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+            for (unsigned node = first; node <= last && node < 64; node++) {
+                node_mask |= 1ul << node;
+            }
+        }
+
+        // Nothing to interleave on a single node machine
+        if (!multiple_bits(node_mask)) return;
+
+        if (syscall(SYS_mbind, mem, bytes, MPOL_INTERLEAVE, &node_mask, 64, 0) != 0) {
+            std::cerr << "warn: failed to interleave hash table across NUMA nodes" << std::endl;
+        }
     }
+#endif
+}
+
+tt::hash_t::hash_t(size_t size, Allocation allocation, size_t threads)
+        : num_buckets(0), allocation(allocation), threads(threads) {
+    resize(size);
 }
 
 tt::hash_t::~hash_t() {
-    delete[] table;
+    deallocate();
 }
 
-bool tt::hash_t::probe(U64 hash, tt::entry_t &entry) {
-    const size_t index = (hash & num_entries) * bucket_size;
-    tt::entry_t *bucket = table + index;
+void tt::hash_t::allocate(size_t bytes) {
+#ifdef __linux__
+    if (!shared_name.empty()) {
+        // Other processes may already be using the segment, so it must have exactly the right size
+        const size_t segment_bytes = sizeof(shared_header_t) + bytes;
+
+        // Every process holds a shared lock on the segment while using it. A segment which was unlinked by the last
+        // process to leave it, between opening and locking, has no links left and must be created again.
+        int fd = -1;
+        struct stat st = {};
+        for (int attempt = 0; attempt < 3; attempt++) {
+            fd = shm_open(shared_name.c_str(), O_CREAT | O_RDWR, 0600);
+            if (fd == -1 || flock(fd, LOCK_SH) != 0 || fstat(fd, &st) != 0) {
+                if (fd != -1) close(fd);
+                fd = -1;
+                break;
+            }
+            if (st.st_nlink > 0) break;
+
+            close(fd);
+            fd = -1;
+        }
+
+        if (fd == -1) {
+            std::cerr << "warn: unable to open shared hash table " << shared_name << std::endl;
+        } else if (st.st_size != 0 && size_t(st.st_size) != segment_bytes) {
+            std::cerr << "warn: shared hash table " << shared_name << " has a size of "
+                      << st.st_size / MB << " MB, using a private table instead" << std::endl;
+        } else if (st.st_size == 0 && ftruncate(fd, segment_bytes) != 0) {
+            std::cerr << "warn: unable to resize shared hash table " << shared_name << std::endl;
+        } else {
+            void *mem = mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (mem != MAP_FAILED) {
+                if (allocation != Allocation::DEFAULT) madvise(mem, segment_bytes, MADV_HUGEPAGE);
+
+                shared_header = static_cast<shared_header_t *>(mem);
+                if (st.st_size == 0) shared_header->generation = 1;
+
+                table = reinterpret_cast<tt::bucket_t *>(shared_header + 1);
+                generation = &shared_header->generation;
+                shared_fd = fd;
+                mapped_bytes = segment_bytes;
+                shared = true;
+                return;
+            }
+
+            std::cerr << "warn: unable to map shared hash table " << shared_name << std::endl;
+        }
+
+        if (fd != -1) close(fd);
+    }
+
+    if (allocation != Allocation::DEFAULT) {
+        void *mem = MAP_FAILED;
+        size_t rounded = (bytes + huge_page_size - 1) / huge_page_size * huge_page_size;
+
+        if (allocation == Allocation::EXPLICIT) {
+            mem = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (mem == MAP_FAILED) {
+                std::cerr << "warn: explicit huge pages unavailable, falling back to transparent huge pages" << std::endl;
+            }
+        }
+
+        if (mem == MAP_FAILED) {
+            mem = mmap(nullptr, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mem != MAP_FAILED) madvise(mem, rounded, MADV_HUGEPAGE);
+        }
+
+        if (mem != MAP_FAILED) {
+            if (allocation != Allocation::HUGE_PAGES) interleave(mem, rounded);
+
+            table = static_cast<tt::bucket_t *>(mem);
+            mapped_bytes = rounded;
+            return;
+        }
+
+        std::cerr << "warn: failed to map hash table, falling back to heap allocation" << std::endl;
+    }
+#endif
+
+    // Cache-line aligned so that each bucket occupies exactly one line. The memory is left uninitialised here,
+    // as clear() zeroes it straight afterwards.
+    table = static_cast<tt::bucket_t *>(::operator new[](bytes, std::align_val_t(64)));
+    mapped_bytes = 0;
+}
+
+void tt::hash_t::deallocate() {
+    if (table == nullptr) return;
+
+#ifdef __linux__
+    if (shared) {
+        local_generation = generation->load();
+        generation = &local_generation;
+        munmap(shared_header, mapped_bytes);
+
+        // Remove the segment if no other process holds a lock on it
+        if (flock(shared_fd, LOCK_EX | LOCK_NB) == 0) shm_unlink(shared_name.c_str());
+        close(shared_fd);
+
+        shared_header = nullptr;
+        shared_fd = -1;
+        table = nullptr;
+        shared = false;
+        return;
+    }
+
+    if (mapped_bytes) {
+        munmap(table, mapped_bytes);
+        table = nullptr;
+        shared = false;
+        return;
+    }
+#endif
+
+    ::operator delete[](table, std::align_val_t(64));
+    table = nullptr;
+}
+
+void tt::hash_t::resize(size_t size) {
+    // Divide size by the sizeof a bucket. Any number of buckets can be indexed, so none of the size is wasted.
+    size_t new_buckets = size / sizeof(tt::bucket_t);
+
+    if (table == nullptr || new_buckets != num_buckets) {
+        deallocate();
+        num_buckets = new_buckets;
+        if (num_buckets == 0) return;
+        allocate(num_buckets * sizeof(tt::bucket_t));
+    }
+
+    // New shared memory segments are already zeroed, and existing ones are in use by other processes
+    if (!shared) clear();
+}
+
+void tt::hash_t::clear() {
+    if (table == nullptr) return;
+
+    const size_t n_threads = std::max(size_t(1), std::min(threads, num_buckets));
+    const size_t chunk = num_buckets / n_threads;
+
+    // Each thread clears a contiguous slice of the table. The threads are not pinned, so this is only for speed:
+    // it says nothing about which NUMA nodes the pages end up on.
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < n_threads; i++) {
+        size_t begin = i * chunk;
+        size_t end = i == n_threads - 1 ? num_buckets : begin + chunk;
+        workers.emplace_back([this, begin, end] () {
+            std::memset(static_cast<void *>(table + begin), 0, (end - begin) * sizeof(tt::bucket_t));
+        });
+    }
 
-    if((bucket->coded_hash ^ bucket->data) == hash) {
-        bucket->refresh(generation);
-        entry = *bucket;
-        return true;
+    for (auto &worker : workers) {
+        worker.join();
     }
 
-    for(size_t i = 1; i < bucket_size; i++) {
-        if(((bucket + i)->coded_hash ^ (bucket + i)->data) == hash) {
-            (bucket + i)->refresh(generation);
-            entry = *(bucket + i);
+    *generation = 1;
+}
+
+void tt::hash_t::set_allocation(Allocation new_allocation) {
+    if (new_allocation == allocation) return;
+
+    allocation = new_allocation;
+    if (table != nullptr) {
+        deallocate();
+        allocate(num_buckets * sizeof(tt::bucket_t));
+        if (!shared) clear();
+    }
+}
+
+void tt::hash_t::set_shared(const std::string &name) {
+    std::string new_name = name.empty() || name[0] == '/' ? name : "/" + name;
+    if (new_name == shared_name) return;
+
+#ifndef __linux__
+    if (!new_name.empty()) std::cerr << "warn: shared hash tables are only supported on Linux" << std::endl;
+#endif
+
+    // Detach from the old segment before forgetting its name, so that it can be unlinked
+    bool reallocate = table != nullptr;
+    if (reallocate) deallocate();
+
+    shared_name = new_name;
+    if (reallocate) {
+        allocate(num_buckets * sizeof(tt::bucket_t));
+        if (!shared) clear();
+    }
+}
+
+void tt::hash_t::set_threads(size_t new_threads) {
+    threads = new_threads;
+}
+
+bool tt::hash_t::probe(U64 hash, tt::entry_t &entry) {
+    tt::bucket_t &bucket = table[bucket_index(hash, num_buckets)];
+
+    for (size_t i = 0; i < bucket_t::size; i++) {
+        if (bucket.matches(i, hash)) {
+            bucket.refresh(i, *generation);
+            entry = bucket.get(i, hash);
+            TT_STAT(local.stats.hits++);
+            TT_STAT(if (entry.bound() == NONE) local.stats.collisions++);
             return true;
         }
     }
+
+    TT_STAT(local.stats.misses++);
     return false;
 }
 
 void tt::hash_t::save(Bound bound, U64 hash, int depth, int ply, int static_eval, int score, move_t move) {
-    const size_t index = (hash & num_entries) * bucket_size;
-    tt::entry_t *bucket = table + index;
+    tt::bucket_t &bucket = table[bucket_index(hash, num_buckets)];
+    const unsigned current = *generation;
 
     if (score >= MINCHECKMATE) score += ply;
     if (score <= -MINCHECKMATE) score -= ply;
@@ -54,56 +329,213 @@ void tt::hash_t::save(Bound bound, U64 hash, int depth, int ply, int static_eval
     updated.info.move = compress(move);
     updated.info.static_eval = static_cast<int16_t>(static_eval);
     updated.info.internal_value = static_cast<int16_t>(score);
-    updated.info.about = (generation << 10u) | (uint16_t(bound) << 8u) | uint16_t(depth);
+    updated.info.about = (current << 10u) | (uint16_t(bound) << 8u)
+                         | uint16_t(std::min(depth, MAX_DEPTH) + DEPTH_OFFSET);
     updated.coded_hash = hash ^ updated.data;
 
-    if((bucket->coded_hash ^ bucket->data) == hash) {
-        if(bound == EXACT || depth >= bucket->depth() - 2) {
-            *bucket = updated;
-        }
-        return;
-    }
-
-    tt::entry_t *replace = bucket;
-    for(size_t i = 1; i < bucket_size; i++) {
-        if(((bucket + i)->coded_hash ^ (bucket + i)->data) == hash) {
-            if(bound == EXACT || depth >= bucket->depth() - 2) {
-                *(bucket + i) = updated;
+    size_t replace = 0;
+    unsigned replace_worth = UINT_MAX;
+    for (size_t i = 0; i < bucket_t::size; i++) {
+        tt::entry_t existing = bucket.get(i, hash);
+        if (bucket.matches(i, hash)) {
+            // Quiescence search results never replace main search results, or those of a deeper quiescence ply
+            if (depth > 0 ? (bound == EXACT || depth >= existing.depth() - 2)
+                          : (existing.depth() <= 0 && depth >= existing.depth())) {
+                bucket.set(i, hash, updated);
+                TT_STAT(local.stats.updates++);
+            } else {
+                TT_STAT(local.stats.kept++);
             }
             return;
-        } else if((bucket + i)->info.about < replace->info.about) {
-            replace = (bucket + i);
+        } else if (existing.worth(current) < replace_worth) {
+            replace = i;
+            replace_worth = existing.worth(current);
         }
     }
 
+    // Quiescence search results are only kept while there is room for them, and never push out main search
+    // results from the current search
+    tt::entry_t replaced = bucket.get(replace, hash);
+    if (depth <= 0 && replaced.bound() != NONE && replaced.depth() > 0 && replaced.age(current) == 0) return;
+
     // Replace best candidate
-    *replace = updated;
+#ifdef TOPPLE_TT_STATS
+    if (replaced.bound() == NONE) {
+        local.stats.fills++;
+    } else {
+        local.stats.overwrites[std::min(size_t(std::max(replaced.depth(), 0) / 4), stats_t::depth_buckets - 1)]++;
+    }
+#endif
+    bucket.set(replace, hash, updated);
 }
 
 void tt::hash_t::age() {
-    generation++;
-    if(generation >= 63) {
-        generation = 1;
+    // Entries are compared by their distance from the current generation, so the generation can simply wrap
+    unsigned current = *generation;
+    while (!generation->compare_exchange_weak(current, (current + 1) & 63u));
+}
 
-        // Clear up hash
-        for (size_t i = 0; i < num_entries * bucket_size; i++) {
-            table[i].refresh(0);
+size_t tt::hash_t::hash_full() {
+    constexpr size_t sample_buckets = 1000;
+
+    assert(num_buckets > sample_buckets);
+
+    size_t cnt = 0;
+    for (size_t i = 0; i < sample_buckets; i++) {
+        for (size_t j = 0; j < bucket_t::size; j++) {
+            tt::entry_t entry = table[i].get(j, 0);
+            if (entry.bound() != NONE && entry.generation() == *generation) {
+                cnt++;
+            }
         }
     }
+
+    return cnt / bucket_t::size;
 }
 
-size_t tt::hash_t::hash_full() {
-    constexpr size_t sample_size = 4000;
-    constexpr size_t divisor = sample_size / 1000;
+bool tt::hash_t::dump(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "warn: unable to open " << path << " for writing" << std::endl;
+        return false;
+    }
 
-    assert(num_entries * bucket_size > sample_size);
+    snapshot_header_t header = {};
+    std::memcpy(header.magic, snapshot_magic, sizeof(header.magic));
+    header.version = snapshot_version;
+    header.bucket_entries = bucket_t::size;
+    header.num_buckets = num_buckets;
+    header.generation = *generation;
 
-    size_t cnt = 0;
-    for (size_t i = 0; i < sample_size; i++) {
-        if (table[i].generation() == generation) {
-            cnt++;
+    std::vector<char> page(snapshot_offset);
+    std::memcpy(page.data(), &header, sizeof(header));
+    file.write(page.data(), page.size());
+    file.write(reinterpret_cast<const char *>(table), num_buckets * sizeof(bucket_t));
+
+    if (!file) {
+        std::cerr << "warn: failed to write hash table snapshot to " << path << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool tt::hash_t::load(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "warn: unable to open " << path << " for reading" << std::endl;
+        return false;
+    }
+
+    snapshot_header_t header = {};
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, snapshot_magic, sizeof(header.magic)) != 0) {
+        std::cerr << "warn: " << path << " is not a hash table snapshot" << std::endl;
+        return false;
+    }
+
+    if (header.version != snapshot_version || header.bucket_entries != bucket_t::size) {
+        std::cerr << "warn: " << path << " was saved by an incompatible version of Topple" << std::endl;
+        return false;
+    }
+
+    if (header.num_buckets != num_buckets) {
+        std::cerr << "warn: " << path << " was saved with a hash size of "
+                  << header.num_buckets * sizeof(bucket_t) / MB << " MB" << std::endl;
+        return false;
+    }
+
+    const size_t bytes = num_buckets * sizeof(bucket_t);
+    file.seekg(0, std::ios::end);
+    if (!file || size_t(file.tellg()) < snapshot_offset + bytes) {
+        std::cerr << "warn: " << path << " is truncated" << std::endl;
+        return false;
+    }
+
+#ifdef __linux__
+    // Map the buckets privately, so that the table can be used immediately and writes never reach the file.
+    // A shared table is overwritten in place instead, so that it stays shared.
+    if (!shared && snapshot_offset % sysconf(_SC_PAGESIZE) == 0) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd != -1) {
+            void *mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, snapshot_offset);
+            close(fd);
+
+            if (mem != MAP_FAILED) {
+                madvise(mem, bytes, MADV_WILLNEED);
+
+                deallocate();
+                table = static_cast<tt::bucket_t *>(mem);
+                mapped_bytes = bytes;
+                *generation = header.generation;
+                return true;
+            }
         }
     }
+#endif
+
+    file.seekg(snapshot_offset);
+    file.read(reinterpret_cast<char *>(table), bytes);
+    if (!file) {
+        std::cerr << "warn: failed to read hash table snapshot from " << path << std::endl;
+        clear();
+        return false;
+    }
+
+    *generation = header.generation;
+    return true;
+}
+
+#ifdef TOPPLE_TT_STATS
+tt::stats_t &tt::stats_t::operator+=(const tt::stats_t &other) {
+    hits += other.hits;
+    misses += other.misses;
+    collisions += other.collisions;
+    updates += other.updates;
+    kept += other.kept;
+    fills += other.fills;
+    for (size_t i = 0; i < depth_buckets; i++) {
+        overwrites[i] += other.overwrites[i];
+    }
+    return *this;
+}
+
+std::ostream &tt::operator<<(std::ostream &stream, const tt::stats_t &stats) {
+    U64 probes = stats.hits + stats.misses;
+    stream << "probes " << probes
+           << " hits " << stats.hits
+           << " hitrate " << (probes ? stats.hits * 1000 / probes : 0)
+           << " collisions " << stats.collisions
+           << " updates " << stats.updates
+           << " kept " << stats.kept
+           << " fills " << stats.fills
+           << " overwrites";
+    for (size_t i = 0; i < stats_t::depth_buckets; i++) {
+        stream << " " << (i < stats_t::depth_buckets - 1 ? std::to_string(i * 4) + "-" + std::to_string(i * 4 + 3)
+                                                         : std::to_string(i * 4) + "+")
+               << ":" << stats.overwrites[i];
+    }
+    return stream;
+}
+
+tt::stats_t tt::collect_stats() {
+    std::lock_guard<std::mutex> lock(stats_mtx);
+    tt::stats_t total = retired_stats;
+    for (const tt::stats_t *stats : live_stats) {
+        total += *stats;
+    }
+    return total;
+}
+
+void tt::reset_stats() {
+    std::lock_guard<std::mutex> lock(stats_mtx);
+    retired_stats = {};
+    for (tt::stats_t *stats : live_stats) {
+        *stats = {};
+    }
+}
 
-    return cnt / divisor;
+void tt::record_collision() {
+    local.stats.collisions++;
 }
+#endif
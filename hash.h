@@ -5,7 +5,9 @@
 #ifndef TOPPLE_HASH_H
 #define TOPPLE_HASH_H
 
+#include <atomic>
 #include <mutex>
+#include <string>
 
 #include "types.h"
 #include "move.h"
@@ -64,17 +66,17 @@ namespace zobrist {
 }
 
 /**
- * Holds incrementally updated material counts for a position, along with a Zobrist hash
+ * Holds incrementally updated material counts for a position. The Zobrist hash of the material is computed on demand,
+ * as the search does not use it, which keeps game records within a cache line.
  */
 class material_data_t {
     uint8_t counts[2][6] = {};
-    U64 z_hash = 0;
 public:
     material_data_t() = default;
     constexpr material_data_t(
             int w_pawns, int w_knights, int w_bishops, int w_rooks, int w_queens,
             int b_pawns, int b_knights, int b_bishops, int b_rooks, int b_queens
-    ) : counts{}, z_hash(0) {
+    ) : counts{} {
         // Add kings
         inc(WHITE, KING);
         inc(BLACK, KING);
@@ -94,18 +96,24 @@ public:
 
     // Accessors
     [[nodiscard]] constexpr int count(Team team, Piece piece) const { return counts[team][piece]; }
-    [[nodiscard]] constexpr U64 hash() const { return z_hash; }
-
-    constexpr void inc(Team team, Piece piece) {
+    [[nodiscard]] constexpr U64 hash() const {
         // We reuse piece-square hashes for material hashing. The square used corresponds to the count
         // e.g. the first pawn has the hash of a pawn on square 0, the second on square 1, etc.
-        z_hash ^= zobrist::squares[counts[team][piece]++][team][piece];
-        assert(counts[team][piece] >= 0);
+        U64 z_hash = 0;
+        for (Team team : {WHITE, BLACK}) {
+            for (Piece piece : {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING}) {
+                for (int i = 0; i < counts[team][piece]; i++) z_hash ^= zobrist::squares[i][team][piece];
+            }
+        }
+        return z_hash;
+    }
+
+    constexpr void inc(Team team, Piece piece) {
+        counts[team][piece]++;
     }
     constexpr void dec(Team team, Piece piece) {
-        // Note the prefix instead of postfix operator here.
-        z_hash ^= zobrist::squares[--counts[team][piece]][team][piece];
-        assert(counts[team][piece] >= 0);
+        assert(counts[team][piece] > 0);
+        counts[team][piece]--;
     }
 };
 
@@ -115,7 +123,23 @@ namespace tt {
         NONE=0, UPPER, LOWER, EXACT
     };
 
-    // Only use power of 2 sizes for efficiency (& rather than % for hashing)
+    // Quiescence search results are saved below depth 1: depth 0 for the ply which searches quiet checks, -1 for
+    // evasions, and -2 for captures only. Depths are stored with an offset, so that they fit in 8 unsigned bits.
+    constexpr int QS_CHECKS_DEPTH = 0;
+    constexpr int QS_EVASIONS_DEPTH = -1;
+    constexpr int QS_CAPTURES_DEPTH = -2;
+    constexpr int DEPTH_OFFSET = -QS_CAPTURES_DEPTH;
+    constexpr int MAX_DEPTH = 255 - DEPTH_OFFSET;
+
+    // Policies for allocating the memory behind the hash table
+    enum class Allocation : uint8_t {
+        DEFAULT, // Heap memory, with pages placed by the operating system
+        HUGE_PAGES, // Anonymous mapping advised to use transparent huge pages
+        INTERLEAVED, // HUGE_PAGES, with pages interleaved across all NUMA nodes
+        EXPLICIT, // Explicit (hugetlbfs) huge pages interleaved across all NUMA nodes, or INTERLEAVED if unavailable
+    };
+
+    // Round a size down to a power of 2, so that a table can be indexed with & rather than %
     inline size_t lower_power_of_2(size_t size) {
         if (size & (size - 1)) { // Check if size is a power of 2
             for (unsigned int i = 1; i < 64; i++) {
@@ -129,6 +153,18 @@ namespace tt {
         return size;
     }
 
+    /**
+     * Map a hash uniformly onto the range [0, n) using the high half of a 64x64->128 bit multiplication.
+     * Unlike masking, this works for any n, so a table can use all of the memory it is given.
+     *
+     * @param hash uniformly distributed hash
+     * @param n number of buckets
+     * @return bucket index
+     */
+    inline size_t bucket_index(U64 hash, size_t n) {
+        return size_t((__uint128_t(hash) * n) >> 64u);
+    }
+
     /**
      * An entry in the hash table
      */
@@ -172,37 +208,194 @@ namespace tt {
             coded_hash = hash ^ data;
         }
 
+        /**
+         * Return the number of generations since this entry was last written or refreshed. Generations wrap
+         * around, so entries which are exactly a multiple of 64 generations old appear to be new.
+         *
+         * @param current current generation of the hash table
+         * @return age of this entry, from 0 to 63
+         */
+        [[nodiscard]] inline unsigned age(unsigned current) const { return (current - generation()) & 63u; }
+
+        /**
+         * Return how valuable this entry is to keep when choosing an entry to replace. Empty entries are always
+         * replaced first, then older entries, and finally shallower entries of the same age.
+         *
+         * @param current current generation of the hash table
+         * @return value of keeping this entry
+         */
+        [[nodiscard]] inline unsigned worth(unsigned current) const {
+            return bound() == NONE ? 0 : ((63u - age(current)) << 10u) | (info.about & 1023u);
+        }
+
         // Other accessors
         [[nodiscard]] inline unsigned generation() const { return info.about >> 10u; }
         [[nodiscard]] inline Bound bound() const { return Bound((info.about >> 8) & 3u); }
-        [[nodiscard]] inline int depth() const { return int(info.about & 255u); }
+        [[nodiscard]] inline int depth() const { return int(info.about & 255u) - DEPTH_OFFSET; }
     };
     static_assert(sizeof(entry_t) == 16);
 
+#ifdef TOPPLE_TT_COMPACT
+    /**
+     * A bucket of 6 entries in a single cache line. Each entry keeps the 8 data bytes of an entry_t, but
+     * only a 16 bit check in place of the full 64 bit coded hash. The check is the low 16 bits of the hash
+     * XORed with a 16 bit fold of the data, so a write torn by another thread is almost always detected.
+     */
+    struct alignas(64) bucket_t {
+        static constexpr size_t size = 6;
+
+        [[nodiscard]] inline bool matches(size_t i, U64 hash) const {
+            return data[i] != 0 && check[i] == checksum(hash, data[i]);
+        }
+        [[nodiscard]] inline entry_t get(size_t i, U64 hash) const {
+            entry_t entry = {};
+            entry.data = data[i];
+            entry.coded_hash = hash ^ entry.data;
+            return entry;
+        }
+        inline void set(size_t i, U64 hash, const entry_t &entry) {
+            data[i] = entry.data;
+            check[i] = checksum(hash, entry.data);
+        }
+        inline void refresh(size_t i, unsigned gen) {
+            U64 hash = check[i] ^ checksum(0, data[i]); // Recover the low bits of the hash
+            entry_t entry = get(i, hash);
+            entry.refresh(gen);
+            set(i, hash, entry);
+        }
+    private:
+        static inline uint16_t checksum(U64 hash, U64 entry_data) {
+            entry_data ^= entry_data >> 32u;
+            entry_data ^= entry_data >> 16u;
+            return uint16_t(hash ^ entry_data);
+        }
+
+        uint16_t check[size];
+        uint32_t padding;
+        U64 data[size];
+    };
+#else
+    /**
+     * A bucket of 4 full entries in a single cache line
+     */
+    struct alignas(64) bucket_t {
+        static constexpr size_t size = 4;
+
+        [[nodiscard]] inline bool matches(size_t i, U64 hash) const {
+            return (entries[i].coded_hash ^ entries[i].data) == hash;
+        }
+        [[nodiscard]] inline entry_t get(size_t i, U64) const { return entries[i]; }
+        inline void set(size_t i, U64, const entry_t &entry) { entries[i] = entry; }
+        inline void refresh(size_t i, unsigned gen) { entries[i].refresh(gen); }
+    private:
+        entry_t entries[size];
+    };
+#endif
+    static_assert(sizeof(bucket_t) == 64);
+
+#ifdef TOPPLE_TT_STATS
+    /**
+     * Counters for the hash table. Each thread keeps its own counters, which are summed by collect_stats.
+     */
+    struct stats_t {
+        static constexpr size_t depth_buckets = 5; // Overwritten depths 0-3 (with quiescence), 4-7, 8-11, 12-15 and 16+
+
+        U64 hits = 0;
+        U64 misses = 0;
+        U64 collisions = 0; // Hits which failed a sanity check, and so must belong to a different position
+        U64 updates = 0; // Saves which replaced an entry for the same position
+        U64 kept = 0; // Saves which left a deeper entry for the same position in place
+        U64 fills = 0; // Saves into an empty slot
+        U64 overwrites[depth_buckets] = {}; // Saves which replaced another position, by depth of the old entry
+
+        stats_t &operator+=(const stats_t &other);
+    };
+
+    std::ostream &operator<<(std::ostream &stream, const stats_t &stats);
+
+    /**
+     * Sum the counters of all threads, including threads which have since exited
+     *
+     * @return hash table counters
+     */
+    stats_t collect_stats();
+
+    /**
+     * Reset the counters of all threads. Must not be called while other threads are using a hash table.
+     */
+    void reset_stats();
+
+    /**
+     * Count a hit which was found to belong to a different position, e.g. because its move is not pseudo-legal
+     */
+    void record_collision();
+#endif
+
     class hash_t {
-        static constexpr size_t bucket_size = 4;
     public:
         /**
-         * Construct a new hash table with the given size in bytes
+         * Construct a new hash table with the given size in bytes. The table is cleared in parallel
+         * by the given number of threads, so that large tables are ready sooner.
          *
          * @param size size of table
+         * @param allocation memory allocation policy
+         * @param threads number of threads to use for clearing the table
          */
-        explicit hash_t(size_t size);
+        explicit hash_t(size_t size, Allocation allocation = Allocation::DEFAULT, size_t threads = 1);
         ~hash_t();
 
         // Hash tables are huge, don't copy them
         hash_t(const hash_t &) = delete;
 
+        /**
+         * Resize the hash table in place to the given size in bytes, and clear it.
+         * Memory is only reallocated if the number of entries changes.
+         *
+         * @param size new size of table
+         */
+        void resize(size_t size);
+
+        /**
+         * Remove all entries from the hash table, without reallocating it
+         */
+        void clear();
+
+        /**
+         * Change the allocation policy of the hash table, reallocating and clearing it if necessary
+         *
+         * @param new_allocation memory allocation policy
+         */
+        void set_allocation(Allocation new_allocation);
+
+        /**
+         * Back the hash table with the named POSIX shared memory segment, so that it is shared with other
+         * processes using the same name and hash size. The segment is created if it does not exist, and its
+         * contents are kept, both when joining and when resizing to the same size. The generation is kept in the
+         * segment, and the last process to detach removes it. An empty name returns to a private table.
+         *
+         * @param name name of the shared memory segment, or an empty string
+         */
+        void set_shared(const std::string &name);
+
+        /**
+         * @return true if the hash table is in a shared memory segment
+         */
+        [[nodiscard]] bool is_shared() const { return shared; }
+
+        /**
+         * Set the number of threads used to clear the hash table
+         *
+         * @param new_threads number of threads
+         */
+        void set_threads(size_t new_threads);
+
         /**
          * Prefetch an entry in the hash table
          *
          * @param hash hash of the entry to prefetch
          */
         inline void prefetch(U64 hash) {
-            const size_t index = (hash & num_entries) * bucket_size;
-            tt::entry_t *bucket = table + index;
-
-            __builtin_prefetch(bucket);
+            __builtin_prefetch(table + bucket_index(hash, num_buckets));
         }
 
         /**
@@ -240,10 +433,47 @@ namespace tt {
          * @return hash table use, permill
          */
         size_t hash_full();
+
+        /**
+         * Write the contents of the hash table to a snapshot file, which can be restored with load.
+         *
+         * @param path path of the snapshot file
+         * @return true on success, false otherwise
+         */
+        bool dump(const std::string &path) const;
+
+        /**
+         * Replace the contents of the hash table with a snapshot written by dump. The snapshot is memory
+         * mapped where possible, so that entries are paged in lazily as they are probed. Snapshots from other
+         * versions, bucket layouts, or hash sizes are rejected, leaving the table unchanged.
+         *
+         * @param path path of the snapshot file
+         * @return true on success, false otherwise
+         */
+        bool load(const std::string &path);
     private:
-        size_t num_entries;
-        unsigned generation = 1;
-        entry_t *table;
+        // Start of a shared memory segment, padded to a bucket so that the table after it stays aligned
+        struct alignas(64) shared_header_t {
+            std::atomic<unsigned> generation; // Shared, so that every process ages the same entries
+        };
+        static_assert(sizeof(shared_header_t) == sizeof(bucket_t));
+
+        void allocate(size_t bytes);
+        void deallocate();
+
+        size_t num_buckets;
+        std::atomic<unsigned> local_generation = 1;
+        std::atomic<unsigned> *generation = &local_generation; // In the shared header if the table is shared
+        bucket_t *table = nullptr;
+
+        // Memory management
+        Allocation allocation;
+        size_t threads;
+        size_t mapped_bytes = 0; // Size of the mapping if the table was mapped, 0 if it was allocated on the heap
+        std::string shared_name;
+        shared_header_t *shared_header = nullptr;
+        int shared_fd = -1; // Kept open with a shared lock while mapped, so that the last process can unlink it
+        bool shared = false;
     };
 }
 
@@ -1,3 +1,4 @@
+#include <atomic>
 #include <memory>
 #include <iostream>
 #include <sstream>
@@ -6,32 +7,41 @@
 
 #include "board.h"
 #include "search.h"
+#include "bench.h"
+#include "perft.h"
 #include "fathom.h"
 
-U64 perft(board_t &, int);
-
 int main(int argc, char *argv[]) {
     // Initialise engine
     init_tables();
     evaluator_t::eval_init();
 
-    // Board
+    // Evaluation
+    processed_params_t params = processed_params_t(eval_params_t());
+
+    // Benchmark from the command line: Topple bench [depth] [threads] [hash]
+    if (argc > 1 && std::string(argv[1]) == "bench") {
+        return bench(params, std::vector<std::string>(argv + 2, argv + argc)) ? 0 : 1;
+    }
+
+    // Board, with the start position and the moves made from it by position commands
     std::unique_ptr<board_t> board = nullptr;
+    std::string position_base;
+    std::vector<std::string> position_moves;
 
     // Hash
     uint64_t hash_size = 128;
+    tt::Allocation hash_allocation = tt::Allocation::DEFAULT;
     tt::hash_t *tt;
     std::mutex tt_memory_mtx;
-    tt = new tt::hash_t(hash_size * MB);
-
-    // Evaluation
-    processed_params_t params = processed_params_t(eval_params_t());
+    tt = new tt::hash_t(hash_size * MB, hash_allocation);
 
     // Search
     std::unique_ptr<search_t> search = std::make_unique<search_t>(tt, params, 1);
     std::atomic_bool search_abort;
     std::future<void> future;
-    bool search_active;
+    std::atomic_bool search_active = false;
+    bool debug = false;
 
     // Parameters
     size_t threads = 1;
@@ -52,17 +62,35 @@ int main(int argc, char *argv[]) {
             std::string cmd;
             iss >> cmd;
 
+            // Treat "go perft <depth>" as "perft <depth>"
+            if (cmd == "go") {
+                std::streampos args = iss.tellg();
+                std::string type;
+                if (iss >> type && type == "perft") {
+                    cmd = "perft";
+                } else {
+                    iss.clear();
+                    iss.seekg(args);
+                }
+            }
+
             if (cmd == "uci") {
                 // Print ids
                 std::cout << "id name Topple " << TOPPLE_VER << std::endl;
                 std::cout << "id author Vincent Tang" << std::endl;
+                std::cout << "info string kernels " << kernel_target() << std::endl;
 
                 // Print options
                 std::cout << "option name Hash type spin default 128 min 1 max 131072" << std::endl;
+                std::cout << "option name HashAllocation type combo default Default"
+                             " var Default var HugePages var Interleaved var Explicit" << std::endl;
+                std::cout << "option name HashShared type string default <empty>" << std::endl;
+                std::cout << "option name EvalCache type spin default 256 min 0 max 65536" << std::endl;
                 std::cout << "option name MoveOverhead type spin default 50 min 0 max 10000" << std::endl;
                 std::cout << "option name Threads type spin default 1 min 1 max 256" << std::endl;
                 std::cout << "option name SyzygyPath type string default <empty>" << std::endl;
                 std::cout << "option name Ponder type check default false" << std::endl;
+                std::cout << "option name SliderLookup type combo default Auto var Auto var Magic var PEXT" << std::endl;
 
                 std::cout << "uciok" << std::endl;
             } else if (cmd == "setoption") {
@@ -83,12 +111,51 @@ int main(int argc, char *argv[]) {
                         // Resize hash
                         {
                             std::lock_guard<std::mutex> lock(tt_memory_mtx);
-                            delete tt;
-                            tt = new tt::hash_t(hash_size * MB);
+                            tt->resize(hash_size * MB);
+                        }
+                    } else if (name == "HashAllocation") {
+                        std::string value;
+                        iss >> value; // Skip value
+                        iss >> value;
+
+                        if (value == "Default") {
+                            hash_allocation = tt::Allocation::DEFAULT;
+                        } else if (value == "HugePages") {
+                            hash_allocation = tt::Allocation::HUGE_PAGES;
+                        } else if (value == "Interleaved") {
+                            hash_allocation = tt::Allocation::INTERLEAVED;
+                        } else if (value == "Explicit") {
+                            hash_allocation = tt::Allocation::EXPLICIT;
+                        } else {
+                            std::cerr << "warn: unrecognised hash allocation policy " << value << std::endl;
+                            continue;
                         }
 
-                        // Recreate search
-                        search = std::make_unique<search_t>(tt, params, threads);
+                        // Reallocate hash
+                        {
+                            std::lock_guard<std::mutex> lock(tt_memory_mtx);
+                            tt->set_allocation(hash_allocation);
+                        }
+                    } else if (name == "HashShared") {
+                        std::string value;
+                        iss >> value; // Skip value
+
+                        std::string shared_name;
+                        std::getline(iss >> std::ws, shared_name);
+                        if (shared_name == "<empty>") shared_name.clear();
+
+                        // Move the hash into (or out of) shared memory
+                        {
+                            std::lock_guard<std::mutex> lock(tt_memory_mtx);
+                            tt->set_shared(shared_name);
+                        }
+                    } else if (name == "EvalCache") {
+                        std::string value;
+                        iss >> value; // Skip value
+
+                        size_t eval_cache_size;
+                        iss >> eval_cache_size;
+                        search->set_eval_cache_size(eval_cache_size * 1024);
                     } else if (name == "MoveOverhead") {
                         std::string value;
                         iss >> value;
@@ -98,7 +165,8 @@ int main(int argc, char *argv[]) {
                         iss >> value; // Skip value
                         iss >> threads;
 
-                        search = std::make_unique<search_t>(tt, params, threads);
+                        search->set_threads(threads);
+                        tt->set_threads(threads);
                     } else if (name == "SyzygyPath") {
                         std::string value;
                         iss >> value; // Skip value
@@ -112,6 +180,24 @@ int main(int argc, char *argv[]) {
                         std::cout << "found " << tb_largest() << " piece tablebases" << std::endl;
                     } else if (name == "Ponder") {
                         // Do nothing
+                    } else if (name == "SliderLookup") {
+                        std::string value;
+                        iss >> value; // Skip value
+                        iss >> value;
+
+                        if (value == "Auto") {
+                            bb_sliders::use_pext = bb_sliders::fast_pext();
+                        } else if (value == "Magic") {
+                            bb_sliders::use_pext = false;
+                        } else if (value == "PEXT") {
+#ifdef __BMI2__
+                            bb_sliders::use_pext = true;
+#else
+                            std::cerr << "warn: PEXT slider lookups require a build with BMI2" << std::endl;
+#endif
+                        } else {
+                            std::cerr << "warn: unrecognised slider lookup " << value << std::endl;
+                        }
                     } else {
                         std::cerr << "warn: unrecognised option " << name << std::endl;
                     }
@@ -130,38 +216,81 @@ int main(int argc, char *argv[]) {
                     std::cerr << "warn: stop command received, but no search was in progress" << std::endl;
                 }
             } else if (cmd == "position") {
-                std::string type;
-                while (iss >> type) {
-                    if (type == "startpos") {
-                        board = std::make_unique<board_t>("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
-                    } else if (type == "fen") {
-                        std::string fen;
-                        for (int i = 0; i < 6; i++) {
-                            std::string component;
-                            iss >> component;
-                            fen += component + " ";
+                if (search_active) {
+                    std::cerr << "warn: position command rejected as search is in progress" << std::endl;
+                } else {
+                    std::string type, base;
+                    std::vector<std::string> moves;
+                    while (iss >> type) {
+                        if (type == "startpos") {
+                            base = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+                        } else if (type == "fen") {
+                            std::string fen;
+                            for (int i = 0; i < 6; i++) {
+                                std::string component;
+                                iss >> component;
+                                fen += component + " ";
+                            }
+                            base = fen;
+                        } else if (type == "moves") {
+                            std::string move_str;
+                            while (iss >> move_str) moves.push_back(move_str);
                         }
+                    }
 
-                        board = std::make_unique<board_t>(fen);
-                    } else if (type == "moves") {
+                    size_t first_new = 0;
+                    if (base.empty()) {
+                        // Continue from the current position
                         if (board) {
-                            // Read moves
-                            std::string move_str;
-                            while (iss >> move_str) {
-                                move_t move = board->parse_move(move_str);
-                                if (board->is_pseudo_legal(move)) {
-                                    board->move(move);
-                                    if (board->is_illegal()) {
-                                        std::cerr << "warn: illegal move " << move_str << std::endl;
-                                        board->unmove();
-                                    }
-                                } else {
-                                    std::cerr << "warn: invalid move " << move_str << std::endl;
-                                }
-                            }
+                            first_new = position_moves.size();
+                            position_moves.insert(position_moves.end(), moves.begin(), moves.end());
                         } else {
                             std::cerr << "warn: no start position specified" << std::endl;
                         }
+                    } else if (board && base == position_base) {
+                        // GUIs resend the whole game, so only take back and make the moves which differ
+                        size_t common = 0;
+                        while (common < position_moves.size() && common < moves.size()
+                               && position_moves[common] == moves[common]) {
+                            common++;
+                        }
+
+                        for (size_t i = common; i < position_moves.size(); i++) board->unmove();
+                        position_moves = moves;
+                        first_new = common;
+                    } else {
+                        // Copy assign into the existing board, so that its record stack keeps its capacity
+                        if (board) {
+                            const board_t start(base);
+                            *board = start;
+                        } else {
+                            board = std::make_unique<board_t>(base);
+                        }
+                        position_base = base;
+                        position_moves = moves;
+                    }
+
+                    // Make the new moves, forgetting any which are rejected
+                    for (size_t i = first_new; board && i < position_moves.size();) {
+                        const std::string &move_str = position_moves[i];
+                        move_t move = board->parse_move(move_str);
+                        bool valid = board->is_pseudo_legal(move);
+                        if (valid) {
+                            board->move(move);
+                            if (board->is_illegal()) {
+                                std::cerr << "warn: illegal move " << move_str << std::endl;
+                                board->unmove();
+                                valid = false;
+                            }
+                        } else {
+                            std::cerr << "warn: invalid move " << move_str << std::endl;
+                        }
+
+                        if (valid) {
+                            i++;
+                        } else {
+                            position_moves.erase(position_moves.begin() + i);
+                        }
                     }
                 }
             } else if (cmd == "go") {
@@ -242,20 +371,29 @@ int main(int argc, char *argv[]) {
 
                     limits.syzygy_resolve = syzygy_resolve;
 
+#ifdef TOPPLE_TT_STATS
+                    tt::reset_stats();
+#endif
+
                     if (!ponder) search->enable_timer();
 
                     // Start search
                     future = std::async(std::launch::async,
-                                        [&tt, &search, &board, &search_active, ponder, &search_abort, &tt_memory_mtx, limits] {
+                                        [&tt, &search, &board, &search_active, ponder, &search_abort, &tt_memory_mtx, limits, debug] {
                                             search_result_t result = search->think(*board, limits, search_abort);
 
-                                            std::cout << "bestmove " << result.best_move;
-                                            if (result.ponder != EMPTY_MOVE) {
-                                                std::cout << " ponder " << result.ponder;
+                                            if (debug) {
+                                                U64 hits = search->count_eval_cache_hits();
+                                                U64 probes = search->count_eval_cache_probes();
+                                                std::cout << "info string evalcache probes " << probes
+                                                          << " hits " << hits
+                                                          << " hitrate " << (probes ? hits * 1000 / probes : 0)
+                                                          << std::endl;
+#ifdef TOPPLE_TT_STATS
+                                                std::cout << "info string tt " << tt::collect_stats() << std::endl;
+#endif
                                             }
-                                            std::cout << std::endl;
 
-                                            search_active = false;
                                             search->reset_timer();
 
                                             // Age the transposition table
@@ -263,6 +401,15 @@ int main(int argc, char *argv[]) {
                                                 std::lock_guard<std::mutex> lock(tt_memory_mtx);
                                                 tt->age();
                                             }
+
+                                            // Finish before reporting the result, as the GUI may reply immediately
+                                            search_active = false;
+
+                                            std::cout << "bestmove " << result.best_move;
+                                            if (result.ponder != EMPTY_MOVE) {
+                                                std::cout << " ponder " << result.ponder;
+                                            }
+                                            std::cout << std::endl;
                                         }
                     );
                 } else {
@@ -278,19 +425,74 @@ int main(int argc, char *argv[]) {
                 if (search_active) {
                     std::cerr << "warn: ucinewgame command received, but search is in progress" << std::endl;
                 } else {
-                    {
-                        // Recreate hash table
-                        std::lock_guard<std::mutex> lock(tt_memory_mtx);
-                        delete tt;
-                        tt = new tt::hash_t(hash_size * MB);
+                    search->clear_heuristics();
+
+                    // Clear hash table, unless other processes may be using it
+                    std::lock_guard<std::mutex> lock(tt_memory_mtx);
+                    if (!tt->is_shared()) tt->clear();
+                }
+            } else if (cmd == "perft") {
+                int depth = 0;
+                if (search_active) {
+                    std::cerr << "warn: perft command received, but search is in progress" << std::endl;
+                } else if (!board) {
+                    std::cerr << "warn: perft command received, but no position specified" << std::endl;
+                } else if (!(iss >> depth)) {
+                    std::cerr << "warn: perft command received, but no depth specified" << std::endl;
+                } else {
+                    perft_t perft(PERFT_HASH_SIZE, threads);
+                    perft.divide(*board, depth);
+                }
+            } else if (cmd == "bench") {
+                if (search_active) {
+                    std::cerr << "warn: bench command received, but search is in progress" << std::endl;
+                } else {
+                    std::vector<std::string> args;
+                    std::string arg;
+                    while (iss >> arg) args.push_back(arg);
+                    bench(params, args);
+                }
+            } else if (cmd == "debug") {
+                std::string type;
+                iss >> type;
+
+                if (type == "on" || type == "off") {
+                    debug = type == "on";
+                } else if (type == "tt") {
+                    if (search_active) {
+                        std::cerr << "warn: debug tt command received, but search is in progress" << std::endl;
+                    } else {
+#ifdef TOPPLE_TT_STATS
+                        std::cout << "info string tt " << tt::collect_stats() << std::endl;
+#else
+                        std::cerr << "warn: hash table statistics are disabled, build with TOPPLE_TT_STATS" << std::endl;
+#endif
                     }
+                } else {
+                    std::cerr << "warn: unrecognised debug command " << type << std::endl;
+                }
+            } else if (cmd == "tt") {
+                std::string action, path;
+                iss >> action;
+                std::getline(iss >> std::ws, path);
 
-                    // Recreate search
-                    search = std::make_unique<search_t>(tt, params, threads);
+                if (search_active) {
+                    std::cerr << "warn: tt command received, but search is in progress" << std::endl;
+                } else if (path.empty()) {
+                    std::cerr << "warn: tt command received, but no path specified" << std::endl;
+                } else if (action == "save") {
+                    std::lock_guard<std::mutex> lock(tt_memory_mtx);
+                    if (tt->dump(path)) std::cout << "info string saved hash table to " << path << std::endl;
+                } else if (action == "load") {
+                    std::lock_guard<std::mutex> lock(tt_memory_mtx);
+                    if (tt->load(path)) std::cout << "info string loaded hash table from " << path << std::endl;
+                } else {
+                    std::cerr << "warn: unrecognised tt command " << action << std::endl;
                 }
             } else if (cmd == "mirror") {
                 if (board) {
                     board->mirror();
+                    position_base.clear(); // The next position command must set up the board from scratch
                 } else {
                     std::cerr << "warn: mirror command received, but no position specified" << std::endl;
                 }
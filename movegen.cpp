@@ -15,9 +15,23 @@ constexpr U64 STARTING[2] = {
         0x00FF000000000000
 };
 
-movegen_t::movegen_t(const board_t &board) : board(board) {
+movegen_t::movegen_t(const board_t &board, bool legal) : board(board), legal(legal) {
     team = board.now().next_move;
     x_team = Team(!board.now().next_move);
+
+    if (legal) {
+        king_sq = bit_scan(board.pieces(team, KING));
+
+        // Only moves which capture or block a single checker resolve check, and only the king can escape double check
+        checkers = board.now().checkers;
+        if (multiple_bits(checkers)) {
+            target = 0;
+        } else if (checkers) {
+            target = checkers | bits_between(king_sq, bit_scan(checkers));
+        }
+
+        pinned = board.now().blockers[team] & board.side(team);
+    }
 }
 
 int movegen_t::gen_normal(move_t *buf) {
@@ -50,6 +64,7 @@ int movegen_t::gen_noisy(move_t *buf) {
         move.info.to = to;
         move.info.from = to - rel_offset(team, D_NW);
         move.info.captured_type = board.sq(to).piece();
+        if (!(legal_targets(move.info.from) & single_bit(to))) continue;
 
         buf[buf_size++] = move;
     }
@@ -59,6 +74,7 @@ int movegen_t::gen_noisy(move_t *buf) {
         move.info.to = to;
         move.info.from = to - rel_offset(team, D_NE);
         move.info.captured_type = board.sq(to).piece();
+        if (!(legal_targets(move.info.from) & single_bit(to))) continue;
 
         buf[buf_size++] = move;
     }
@@ -78,7 +94,7 @@ int movegen_t::gen_castling(move_t *buf) {
     move_t move = EMPTY_MOVE;
 
     // Generate castling kingside
-    if (board.now().castle[team][0]) {
+    if (board.now().can_castle(team, 0)) {
         if ((board.all() & bits_between(team ? E8 : E1, team ? H8 : H1)) == 0 &&
             !board.is_attacked(team ? E8 : E1, x_team) &&
             !board.is_attacked(team ? F8 : F1, x_team) &&
@@ -96,7 +112,7 @@ int movegen_t::gen_castling(move_t *buf) {
     }
 
     // Generate castling queenside
-    if (board.now().castle[team][1]) {
+    if (board.now().can_castle(team, 1)) {
         if ((board.all() & bits_between(team ? E8 : E1, team ? A8 : A1)) == 0 &&
             !board.is_attacked(team ? E8 : E1, x_team) &&
             !board.is_attacked(team ? D8 : D1, x_team) &&
@@ -130,7 +146,7 @@ int movegen_t::gen_prom(move_t *buf) {
         uint8_t from = pop_bit(bb_promotable);
         move.info.from = from;
 
-        U64 bb_targets = pawn_caps(team, from) & board.side(x_team);
+        U64 bb_targets = pawn_caps(team, from) & board.side(x_team) & legal_targets(from);
 
         while (bb_targets) {
             uint8_t to = pop_bit(bb_targets);
@@ -155,7 +171,7 @@ int movegen_t::gen_prom(move_t *buf) {
         uint8_t from = pop_bit(bb_promotable);
         move.info.from = from;
 
-        U64 bb_targets = find_moves<PAWN>(team, from, board.all()) & mask;
+        U64 bb_targets = find_moves<PAWN>(team, from, board.all()) & mask & legal_targets(from);
 
         while (bb_targets) {
             uint8_t to = pop_bit(bb_targets);
@@ -191,13 +207,133 @@ int movegen_t::gen_ep(move_t *buf) {
             move.info.is_ep = 1;
             move.info.is_capture = 1;
             move.info.captured_type = PAWN;
+
+            // En-passant can expose the king along the rank of both pawns, so check it directly
+            if (legal && !board.is_legal(move)) continue;
+
+            buf[buf_size++] = move;
+        }
+    }
+
+    return buf_size;
+}
+
+int movegen_t::gen_evasions(move_t *buf) {
+    int buf_size = 0;
+    move_t move = EMPTY_MOVE;
+    move.info.team = team;
+
+    // King moves, which are the only evasions from double check
+    move.info.is_capture = 1;
+    gen_piece_caps<KING>(buf, buf_size, move);
+    move.info.is_capture = 0;
+    gen_piece_quiets<KING>(buf, buf_size, move, ~board.all());
+
+    if (multiple_bits(checkers)) return buf_size;
+
+    // A pinned piece can never resolve a check, as it can't leave the line between its king and the pinner
+    uint8_t checker_sq = bit_scan(checkers);
+    U64 movable = board.side(team) & ~board.pieces(team, KING) & ~pinned;
+
+    // Capture the checking piece
+    buf_size += gen_ep(buf + buf_size);
+
+    move.info.is_capture = 1;
+    move.info.captured_type = board.sq(checker_sq).piece();
+    move.info.to = checker_sq;
+    U64 capturers = board.attacks_to(checker_sq, x_team) & movable;
+    while (capturers) {
+        move.info.from = pop_bit(capturers);
+        move.info.piece = board.sq(move.info.from).piece();
+        add_move(buf, buf_size, move);
+    }
+
+    // Block the check
+    move.info.is_capture = 0;
+    move.info.captured_type = 0;
+    U64 blocks = bits_between(king_sq, checker_sq);
+    while (blocks) {
+        uint8_t to = pop_bit(blocks);
+        move.info.to = to;
+
+        U64 blockers = ((find_moves<KNIGHT>(team, to, board.all()) & board.pieces(team, KNIGHT))
+                        | (find_moves<BISHOP>(team, to, board.all())
+                           & (board.pieces(team, BISHOP) | board.pieces(team, QUEEN)))
+                        | (find_moves<ROOK>(team, to, board.all())
+                           & (board.pieces(team, ROOK) | board.pieces(team, QUEEN)))) & movable;
+
+        // Pawn pushes onto the blocking square
+        U64 behind_x1 = team ? bb_shifts::shift<D_N>(single_bit(to)) : bb_shifts::shift<D_S>(single_bit(to));
+        U64 behind_x2 = team ? bb_shifts::shift<D_N>(behind_x1) : bb_shifts::shift<D_S>(behind_x1);
+        if (behind_x1 & board.pieces(team, PAWN)) {
+            blockers |= behind_x1 & movable;
+        } else if (!(behind_x1 & board.all())) {
+            blockers |= behind_x2 & board.pieces(team, PAWN) & STARTING[team] & movable;
+        }
+
+        while (blockers) {
+            move.info.from = pop_bit(blockers);
+            move.info.piece = board.sq(move.info.from).piece();
+            add_move(buf, buf_size, move);
+        }
+    }
+
+    return buf_size;
+}
+
+int movegen_t::gen_quiet_checks(move_t *buf) {
+    int buf_size = 0;
+    move_t move = EMPTY_MOVE;
+    move.info.team = team;
+
+    uint8_t x_king_sq = bit_scan(board.pieces(x_team, KING));
+    U64 direct[6];
+    for (Piece piece : {PAWN, KNIGHT, BISHOP, ROOK, QUEEN, KING}) direct[piece] = board.check_squares(piece);
+
+    // Moving our pieces which block one of our sliders from the enemy king off that line uncovers a check
+    U64 discoverers = board.now().blockers[x_team] & board.side(team);
+
+    // Pawn pushes
+    move.info.piece = PAWN;
+    U64 bb_pawns = board.pieces(team, PAWN) & ~PROMOTING[team];
+    while (bb_pawns) {
+        uint8_t from = pop_bit(bb_pawns);
+        move.info.from = from;
+
+        U64 bb_targets = find_moves<PAWN>(team, from, board.all()) & ~board.all() & legal_targets(from);
+        bb_targets &= (discoverers & single_bit(from)) ? direct[PAWN] | ~line(x_king_sq, from) : direct[PAWN];
+
+        while (bb_targets) {
+            move.info.to = pop_bit(bb_targets);
+
             buf[buf_size++] = move;
         }
     }
 
+    // Piece moves
+    gen_piece_checks<KNIGHT>(buf, buf_size, move, direct[KNIGHT], discoverers, x_king_sq);
+    gen_piece_checks<BISHOP>(buf, buf_size, move, direct[BISHOP], discoverers, x_king_sq);
+    gen_piece_checks<ROOK>(buf, buf_size, move, direct[ROOK], discoverers, x_king_sq);
+    gen_piece_checks<QUEEN>(buf, buf_size, move, direct[QUEEN], discoverers, x_king_sq);
+    gen_piece_checks<KING>(buf, buf_size, move, direct[KING], discoverers, x_king_sq);
+
     return buf_size;
 }
 
+// Add a move to the buffer, expanding pawn moves to the last rank into each promotion
+void movegen_t::add_move(move_t *buf, int &buf_size, move_t move) {
+    if (move.info.piece == PAWN && (PROMOTING[team] & single_bit(move.info.from))) {
+        move.info.is_promotion = 1;
+        for (uint8_t i = QUEEN; i > PAWN; i--) {
+            move.info.promotion_type = i;
+
+            buf[buf_size++] = move;
+        }
+    } else {
+        buf[buf_size++] = move;
+    }
+}
+
 int movegen_t::gen_quiets(move_t *buf) {
     int buf_size = gen_castling(buf);
 
@@ -228,6 +364,7 @@ int movegen_t::gen_quiets(move_t *buf) {
         uint8_t from = pop_bit(single_movers);
         move.info.from = from;
         move.info.to = from + single_offset;
+        if (!(legal_targets(from) & single_bit(move.info.to))) continue;
 
         buf[buf_size++] = move;
     }
@@ -236,6 +373,7 @@ int movegen_t::gen_quiets(move_t *buf) {
         uint8_t from = pop_bit(double_movers);
         move.info.from = from;
         move.info.to = from + double_offset;
+        if (!(legal_targets(from) & single_bit(move.info.to))) continue;
 
         buf[buf_size++] = move;
     }
@@ -261,9 +399,11 @@ void movegen_t::gen_piece_quiets(move_t *buf, int &buf_size, move_t move, U64 ma
         move.info.from = from;
 
         U64 bb_targets = find_moves<TYPE>(team, from, board.all()) & mask;
+        if (TYPE != KING) bb_targets &= legal_targets(from);
 
         while (bb_targets) {
             uint8_t to = pop_bit(bb_targets);
+            if (TYPE == KING && legal && board.is_attacked(to, x_team, board.all() ^ single_bit(from))) continue;
             move.info.to = to;
 
             buf[buf_size++] = move;
@@ -281,9 +421,11 @@ void movegen_t::gen_piece_caps(move_t *buf, int &buf_size, move_t move) {
         move.info.from = from;
 
         U64 bb_targets = find_moves<TYPE>(team, from, board.all()) & board.side(x_team);
+        if (TYPE != KING) bb_targets &= legal_targets(from);
 
         while (bb_targets) {
             uint8_t to = pop_bit(bb_targets);
+            if (TYPE == KING && legal && board.is_attacked(to, x_team, board.all() ^ single_bit(from))) continue;
             move.info.to = to;
             move.info.captured_type = board.sq(to).piece();
 
@@ -291,3 +433,27 @@ void movegen_t::gen_piece_caps(move_t *buf, int &buf_size, move_t move) {
         }
     }
 }
+
+template<Piece TYPE>
+void movegen_t::gen_piece_checks(move_t *buf, int &buf_size, move_t move, U64 direct, U64 discoverers,
+                                 uint8_t x_king_sq) {
+    move.info.piece = TYPE;
+    U64 bb_piece = board.pieces(team, TYPE);
+
+    while (bb_piece) {
+        uint8_t from = pop_bit(bb_piece);
+        move.info.from = from;
+
+        U64 bb_targets = find_moves<TYPE>(team, from, board.all()) & ~board.all();
+        if (TYPE != KING) bb_targets &= legal_targets(from);
+        bb_targets &= (discoverers & single_bit(from)) ? direct | ~line(x_king_sq, from) : direct;
+
+        while (bb_targets) {
+            uint8_t to = pop_bit(bb_targets);
+            if (TYPE == KING && board.is_attacked(to, x_team, board.all() ^ single_bit(from))) continue;
+            move.info.to = to;
+
+            buf[buf_size++] = move;
+        }
+    }
+}
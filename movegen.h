@@ -15,42 +15,86 @@ public:
     /**
      * Create a move generator which generates moves for the given board instance.
      *
+     * In legal mode, the checkers and pinned pieces of the side to move are computed once, and only legal moves are
+     * generated. Otherwise, pseudo-legal moves are generated, which must be checked with board_t::is_legal.
+     *
      * @param board board to generate moves for
+     * @param legal true to generate only legal moves
      */
-    explicit movegen_t(const board_t &board);
+    explicit movegen_t(const board_t &board, bool legal = false);
 
     /**
      * Generate moves in the current state of the board and save them to {@code buf}, overwriting it from index 0.
      *
      * @return the number of moves in {@code buf}
      */
-    int gen_normal(move_t *buf);
+    TOPPLE_HOT int gen_normal(move_t *buf);
 
     /**
      * Generate captures only, ordered MVV/LVA
      *
      * @return the number of moves in {@code buf}
      */
-    int gen_noisy(move_t *buf);
+    TOPPLE_HOT int gen_noisy(move_t *buf);
 
     /**
      * Generate non-captures only, unordered.
      *
      * @return the number of moves in {@code buf}
      */
-    int gen_quiets(move_t *buf);
+    TOPPLE_HOT int gen_quiets(move_t *buf);
+
+    /**
+     * Generate the moves which get the side to move out of check: king moves, captures of the checking piece, and
+     * interpositions. Only valid for a legal move generator when the side to move is in check.
+     *
+     * @return the number of moves in {@code buf}
+     */
+    TOPPLE_HOT int gen_evasions(move_t *buf);
+
+    /**
+     * Generate non-captures which give check, either directly or by uncovering an attack from another piece.
+     * Promotions and castling are not included. Only valid for a legal move generator.
+     *
+     * @return the number of moves in {@code buf}
+     */
+    TOPPLE_HOT int gen_quiet_checks(move_t *buf);
+
+    /**
+     * @return true if the side to move is in check. Only valid for a legal move generator.
+     */
+    bool in_check() const {
+        return checkers != 0;
+    }
 private:
     const board_t &board;
 
     Team team;
     Team x_team;
 
+    // Legal move generation
+    bool legal;
+    uint8_t king_sq = 0;
+    U64 checkers = 0; // Enemy pieces giving check
+    U64 pinned = 0; // Pieces of the side to move which are pinned to their king
+    U64 target = ONES; // Squares which block or capture the checking piece, if in check
+
+    /**
+     * @return squares that a (non-king) piece on the given square may move to without leaving its king in check
+     */
+    inline U64 legal_targets(uint8_t from) const {
+        return (pinned & single_bit(from)) ? target & line(king_sq, from) : target;
+    }
+
     int gen_prom(move_t *buf);
     int gen_castling(move_t *buf);
     int gen_ep(move_t *buf);
+    void add_move(move_t *buf, int &buf_size, move_t move);
 
     template <Piece TYPE> void gen_piece_quiets(move_t *buf, int &buf_size, move_t move, U64 mask);
     template <Piece TYPE> void gen_piece_caps(move_t *buf, int &buf_size, move_t move);
+    template <Piece TYPE> void gen_piece_checks(move_t *buf, int &buf_size, move_t move, U64 direct, U64 discoverers,
+                                                uint8_t x_king_sq);
 };
 
 
@@ -6,7 +6,7 @@
 #include "move.h"
 
 movesort_t::movesort_t(GenMode mode,  const heuristic_set_t &heuristics, const board_t &board, move_t hash_move, move_t refutation, int ply) :
-        mode(mode), heur(heuristics), board(board), hash_move(hash_move), refutation(refutation), gen(movegen_t(board)) {
+        mode(mode), heur(heuristics), board(board), hash_move(hash_move), refutation(refutation), gen(movegen_t(board, true)) {
     killer_1 = heur.killers.primary(ply);
     killer_2 = heur.killers.secondary(ply);
     killer_3 = ply > 2 ? heur.killers.primary(ply - 2) : EMPTY_MOVE;
@@ -29,13 +29,25 @@ move_t movesort_t::next(GenStage &stage, int &score, bool skip_quiets) {
     switch (stage) {
         case GEN_NONE:
             stage = GEN_HASH;
-            if (board.is_pseudo_legal(hash_move)) {
+            if (board.is_pseudo_legal(hash_move) && board.is_legal(hash_move)) {
                 score = INF;
                 return hash_move;
             }
         case GEN_HASH:
-            // Generate captures
-            capt_buf_size = gen.gen_noisy(capt_buf);
+            if (gen.in_check()) {
+                // Generate all evasions at once, and split them into noisy moves and quiets
+                int n = gen.gen_evasions(main_buf);
+                for (int i = 0; i < n; i++) {
+                    if (main_buf[i].info.is_capture || main_buf[i].info.is_promotion) {
+                        capt_buf[capt_buf_size++] = main_buf[i];
+                    } else {
+                        main_buf[main_buf_size++] = main_buf[i];
+                    }
+                }
+            } else {
+                // Generate captures
+                capt_buf_size = gen.gen_noisy(capt_buf);
+            }
 
             stage = GEN_GOOD_NOISY;
         case GEN_GOOD_NOISY:
@@ -55,7 +67,8 @@ move_t movesort_t::next(GenStage &stage, int &score, bool skip_quiets) {
                     return next(stage, score, skip_quiets);
                 }
 
-                if ((score = board.see(capt_buf[capt_idx])) >= 0) {
+                if (board.see_ge(capt_buf[capt_idx], 0)) {
+                    score = 0;
                     return capt_buf[capt_idx++];
                 } else {
                     capt_buf[bad_capt_buf_size++] = capt_buf[capt_idx++];
@@ -68,8 +81,8 @@ move_t movesort_t::next(GenStage &stage, int &score, bool skip_quiets) {
             else return EMPTY_MOVE;
 
             if(!skip_quiets) {
-                // Generate quiets in main buffer
-                main_buf_size = gen.gen_quiets(main_buf);
+                // Generate quiets in main buffer, unless they were generated with the evasions
+                if (!gen.in_check()) main_buf_size = gen.gen_quiets(main_buf);
 
                 // Score quiets
                 for (int i = 0; i < main_buf_size; i++) {
@@ -86,6 +99,8 @@ move_t movesort_t::next(GenStage &stage, int &score, bool skip_quiets) {
                         }
                     }
                 }
+            } else {
+                main_buf_size = 0;
             }
         case GEN_QUIETS:
             // Pick best quiet until there are none left
@@ -30,6 +30,17 @@ public:
     int get(move_t move) const {
         return table[move.info.team][move.info.from][move.info.to];
     }
+
+    // Halve every score, so that the history of previous searches still orders moves but is quickly outweighed
+    void age() {
+        for (auto &team : table) {
+            for (auto &from : team) {
+                for (int16_t &score : from) {
+                    score /= 2;
+                }
+            }
+        }
+    }
 private:
     // Indexed by [TEAM][FROM][TO]
     int16_t table[2][64][64] = {};
@@ -52,6 +63,15 @@ public:
     move_t secondary(int ply) const {
         return killers[ply][1];
     }
+
+    // Move the killers of each ply towards the root after plies have been played, or clear them if plies < 0
+    void shift(int plies) {
+        for (int ply = 0; ply < MAX_PLY; ply++) {
+            bool keep = plies >= 0 && ply + plies < MAX_PLY;
+            killers[ply][0] = keep ? killers[ply + plies][0] : EMPTY_MOVE;
+            killers[ply][1] = keep ? killers[ply + plies][1] : EMPTY_MOVE;
+        }
+    }
 private:
     move_t killers[MAX_PLY][2] = {{}};
 };
@@ -59,6 +79,16 @@ private:
 struct heuristic_set_t {
     history_heur_t history;
     killer_heur_t killers;
+
+    /**
+     * Carry the heuristics over to a search from a later position in the same game
+     *
+     * @param plies number of plies played since the last search, or -1 if the new root is unrelated
+     */
+    void age(int plies) {
+        history.age();
+        killers.shift(plies);
+    }
 };
 
 class movesort_t {
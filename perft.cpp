@@ -0,0 +1,102 @@
+#include <thread>
+#include <atomic>
+
+#include "perft.h"
+#include "movegen.h"
+
+namespace {
+    // Mix the depth into the key, so that the same position at different depths has different entries
+    inline U64 perft_key(U64 hash, int depth) {
+        return hash ^ (U64(depth) * 0x9E3779B97F4A7C15ull);
+    }
+}
+
+perft_t::perft_t(size_t hash_size, size_t threads) : table(hash_size / sizeof(entry_t)), threads(threads) {}
+
+U64 perft_t::divide(const board_t &board, int depth) {
+    auto start = engine_clock::now();
+
+    std::vector<move_t> root_moves;
+    std::vector<U64> counts = split(board, depth, root_moves);
+
+    U64 total = depth <= 0 ? 1 : 0;
+    for (size_t i = 0; depth > 0 && i < root_moves.size(); i++) {
+        std::cout << root_moves[i] << ": " << counts[i] << std::endl;
+        total += counts[i];
+    }
+
+    auto time = CHRONO_DIFF(start, engine_clock::now());
+    std::cout << std::endl << "nodes " << total
+              << " time " << time
+              << " nps " << total * 1000 / std::max(time, decltype(time)(1)) << std::endl;
+
+    return total;
+}
+
+U64 perft_t::total(const board_t &board, int depth) {
+    if (depth <= 0) return 1;
+
+    std::vector<move_t> root_moves;
+    std::vector<U64> counts = split(board, depth, root_moves);
+
+    U64 total = 0;
+    for (U64 nodes : counts) total += nodes;
+    return total;
+}
+
+std::vector<U64> perft_t::split(const board_t &board, int depth, std::vector<move_t> &root_moves) {
+    move_t buf[256];
+    movegen_t gen(board, true);
+    int n = gen.gen_normal(buf);
+
+    root_moves.assign(buf, buf + n);
+
+    // Threads take root moves in turn, each on their own copy of the board
+    std::vector<U64> counts(root_moves.size());
+    std::atomic<size_t> next = 0;
+    std::vector<std::thread> workers;
+    for (size_t i = 0; i < std::max(size_t(1), threads); i++) {
+        workers.emplace_back([this, &board, &root_moves, &counts, &next, depth] () {
+            board_t local = board;
+            for (size_t idx = next++; idx < root_moves.size(); idx = next++) {
+                local.move(root_moves[idx]);
+                counts[idx] = count(local, depth - 1);
+                local.unmove();
+            }
+        });
+    }
+
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    return counts;
+}
+
+U64 perft_t::count(board_t &board, int depth) {
+    if (depth <= 0) return 1;
+
+    move_t buf[256];
+    movegen_t gen(board, true);
+    int n = gen.gen_normal(buf);
+
+    // Count the last ply in bulk, without making the moves
+    if (depth == 1) return n;
+
+    U64 key = perft_key(board.now().hash, depth);
+    entry_t *entry = table.empty() ? nullptr : &table[tt::bucket_index(key, table.size())];
+    if (entry) {
+        entry_t cached = *entry;
+        if ((cached.coded_key ^ cached.nodes) == key) return cached.nodes;
+    }
+
+    U64 nodes = 0;
+    for (int i = 0; i < n; i++) {
+        board.move(buf[i]);
+        nodes += count(board, depth - 1);
+        board.unmove();
+    }
+
+    if (entry) *entry = {key ^ nodes, nodes};
+    return nodes;
+}
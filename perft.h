@@ -0,0 +1,68 @@
+#ifndef TOPPLE_PERFT_H
+#define TOPPLE_PERFT_H
+
+#include <vector>
+
+#include "types.h"
+#include "board.h"
+
+// Size of the hash table used by the perft command, which is allocated alongside the transposition table and so is
+// kept small rather than following the Hash option
+constexpr size_t PERFT_HASH_SIZE = 64 * MB;
+
+/**
+ * Counts the leaf nodes of the legal move tree (perft), to validate move generation. Root moves are split between
+ * threads, the last ply is counted in bulk from the legal move list, and subtree counts are cached in a hash table
+ * keyed by Zobrist hash and depth, shared by all threads.
+ */
+class perft_t {
+public:
+    /**
+     * Construct a new perft counter
+     *
+     * @param hash_size size of the perft hash table in bytes
+     * @param threads number of threads to split root moves between
+     */
+    perft_t(size_t hash_size, size_t threads);
+
+    /**
+     * Count the leaf nodes at the given depth, printing the count for each root move (divide), the total,
+     * and the speed
+     *
+     * @param board position to count from
+     * @param depth depth of the tree
+     * @return number of leaf nodes
+     */
+    U64 divide(const board_t &board, int depth);
+
+    /**
+     * Count the leaf nodes at the given depth, splitting root moves between threads like divide, without printing
+     *
+     * @param board position to count from
+     * @param depth depth of the tree
+     * @return number of leaf nodes
+     */
+    U64 total(const board_t &board, int depth);
+
+    /**
+     * Count the leaf nodes at the given depth on the calling thread
+     *
+     * @param board position to count from, which is left unchanged
+     * @param depth depth of the tree
+     * @return number of leaf nodes
+     */
+    U64 count(board_t &board, int depth);
+private:
+    struct entry_t {
+        U64 coded_key; // = key ^ nodes, so that torn writes by other threads are detected
+        U64 nodes;
+    };
+
+    // Count each root move on the worker threads, returning the root moves and their counts
+    std::vector<U64> split(const board_t &board, int depth, std::vector<move_t> &root_moves);
+
+    std::vector<entry_t> table;
+    size_t threads;
+};
+
+#endif //TOPPLE_PERFT_H
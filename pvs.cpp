@@ -7,17 +7,7 @@
 #include "fathom.h"
 
 namespace pvs {
-    struct pv_move_t {
-        move_t move;
-        int move_number;
-        int reduced_depth;
-        int depth;
-
-        pv_move_t(move_t move, int move_number, int reduced_depth, int depth)
-                : move(move), move_number(move_number), reduced_depth(reduced_depth), depth(depth) {}
-    };
-
-    int context_t::search_root(std::vector<move_t> root_moves,
+    int context_t::search_root(const std::vector<move_t> &root_moves,
                                const std::function<void(int)> &output_info,
                                const std::function<void(int, move_t)> &output_currmove,
                                int alpha, int beta, int depth, const std::atomic_bool &aborted) {
@@ -40,11 +30,10 @@ namespace pvs {
             h_bound = h.bound();
             tt_move = board->to_move(h.info.move);
         } else {
-            stack[0].eval = evaluator->evaluate(*board);
+            stack[0].eval = evaluate();
         }
 
-        std::vector<pv_move_t> move_list;
-        move_list.reserve(64);
+        pv_move_t *move_list = move_frames.get();
         GenStage stage = GEN_NONE;
         int move_score;
 
@@ -53,7 +42,7 @@ namespace pvs {
         movesort_t gen(NORMAL, heur, *board, tt_move, EMPTY_MOVE, 0);
         for (move_t move = gen.next(stage, move_score, false);
              move != EMPTY_MOVE; move = gen.next(stage, move_score, false)) {
-            if (std::find(root_moves.begin(), root_moves.end(), move) != root_moves.end() && board->is_legal(move)) {
+            if (std::find(root_moves.begin(), root_moves.end(), move) != root_moves.end()) {
                 n_legal++;
 
                 bool move_is_check = board->gives_check(move);
@@ -61,11 +50,12 @@ namespace pvs {
 
                 // PV extension
                 if (n_legal == 1) ex = 1;
-                move_list.emplace_back(move, n_legal, depth - 1 + ex, depth - 1 + ex);
+                move_list[n_legal - 1] = {move, n_legal, depth - 1 + ex, depth - 1 + ex};
             }
         }
         // Keep searching until we prove that all other moves are bad.
-        while (!move_list.empty()) {
+        pv_move_t *move_list_end = move_list + n_legal;
+        while (move_list < move_list_end) {
             // Search the first move in the move list as the PV move, and then prove the rest with a zero window search.
             board->move(move_list[0].move);
 
@@ -105,7 +95,7 @@ namespace pvs {
 
             // Search remaining moves in parallel
             bool failed_high = false;
-            for (auto it = move_list.cbegin() + 1; it < move_list.cend(); it++) {
+            for (pv_move_t *it = move_list + 1; it < move_list_end; it++) {
                 if (output_currmove) {
                     output_currmove(it->move_number, it->move);
                 }
@@ -130,7 +120,7 @@ namespace pvs {
 
                 if (score > alpha) {
                     failed_high = true;
-                    move_list.erase(move_list.cbegin(), it);
+                    move_list = it; // Drop the moves before the one that failed high
                     break;
                 }
             }
@@ -163,7 +153,7 @@ namespace pvs {
         if (aborted) {
             return TIMEOUT;
         } else if (ply > MAX_PLY) {
-            return evaluator->evaluate(*board);
+            return evaluate();
         }
 
         // Quiescence search
@@ -192,8 +182,11 @@ namespace pvs {
             stack[ply].eval = h.info.static_eval;
             h_bound = h.bound();
             tt_move = board->to_move(h.info.move);
+#ifdef TOPPLE_TT_STATS
+            if (tt_move != EMPTY_MOVE && !board->is_pseudo_legal(tt_move)) tt::record_collision();
+#endif
         } else {
-            stack[ply].eval = evaluator->evaluate(*board);
+            stack[ply].eval = evaluate();
         }
 
         bool in_check = board->is_incheck();
@@ -241,8 +234,7 @@ namespace pvs {
             }
         }
 
-        std::vector<pv_move_t> move_list;
-        move_list.reserve(64);
+        pv_move_t *move_list = move_frames.get() + ply * MAX_MOVES;
         GenStage stage = GEN_NONE;
         int move_score;
 
@@ -251,39 +243,38 @@ namespace pvs {
         movesort_t gen(NORMAL, heur, *board, tt_move, EMPTY_MOVE, ply);
         for (move_t move = gen.next(stage, move_score, false);
              move != EMPTY_MOVE; move = gen.next(stage, move_score, false)) {
-            if (board->is_legal(move)) {
-                n_legal++;
+            n_legal++;
 
-                bool move_is_check = board->gives_check(move);
-                int ex = move_is_check;
-
-                // Singular extension
-                if (depth >= 8 && move == tt_move
-                    && (h_bound == tt::LOWER || h_bound == tt::EXACT)
-                    && h.depth() >= depth - 2) {
-                    int reduced_beta = (h.value(ply)) - depth;
-                    score = search_zw(reduced_beta, ply, depth / 2, aborted, move);
-                    if (aborted) return TIMEOUT;
+            bool move_is_check = board->gives_check(move);
+            int ex = move_is_check;
 
-                    if (score < reduced_beta) {
-                        ex = 1;
-                    }
-                }
+            // Singular extension
+            if (depth >= 8 && move == tt_move
+                && (h_bound == tt::LOWER || h_bound == tt::EXACT)
+                && h.depth() >= depth - 2) {
+                int reduced_beta = (h.value(ply)) - depth;
+                score = search_zw(reduced_beta, ply, depth / 2, aborted, move);
+                if (aborted) return TIMEOUT;
 
-                int R = 0;
-                // Late move reductions
-                if (depth >= 3 && n_legal > 1) {
-                    // LMR
-                    R = depth / 8 + n_legal / 8 - improving;
-                    if (stage == GEN_QUIETS && move_score < 0) R++;
-                    if (R >= 1 && board->see(reverse(move)) < 0) R -= 2;
+                if (score < reduced_beta) {
+                    ex = 1;
                 }
+            }
 
-                move_list.emplace_back(move, n_legal, depth - R - 1 + ex, depth - 1 + ex);
+            int R = 0;
+            // Late move reductions
+            if (depth >= 3 && n_legal > 1) {
+                // LMR
+                R = depth / 8 + n_legal / 8 - improving;
+                if (stage == GEN_QUIETS && move_score < 0) R++;
+                if (R >= 1 && !board->see_ge(reverse(move), 0)) R -= 2;
             }
+
+            move_list[n_legal - 1] = {move, n_legal, depth - R - 1 + ex, depth - 1 + ex};
         }
         // Keep searching until we prove that all other moves are bad.
-        while (!move_list.empty()) {
+        pv_move_t *move_list_end = move_list + n_legal;
+        while (move_list < move_list_end) {
             // Search the first move in the move list as the PV move, and then prove the rest with a zero window search.
             board->move(move_list[0].move);
             score = -search_pv(-beta, -alpha, ply + 1, move_list[0].depth, aborted);
@@ -314,7 +305,7 @@ namespace pvs {
 
             // Search remaining moves in parallel
             bool failed_high = false;
-            for (auto it = move_list.cbegin() + 1; it < move_list.cend(); it++) {
+            for (pv_move_t *it = move_list + 1; it < move_list_end; it++) {
                 board->move(it->move);
                 bool full_search = true;
                 if (it->reduced_depth < it->depth) {
@@ -334,7 +325,7 @@ namespace pvs {
 
                 if (score > alpha) {
                     failed_high = true;
-                    move_list.erase(move_list.cbegin(), it);
+                    move_list = it; // Drop the moves before the one that failed high
                     break;
                 }
             }
@@ -362,7 +353,7 @@ namespace pvs {
     }
 
     template<bool PV>
-    int context_t::search_qs(int alpha, int beta, const int ply, const std::atomic_bool &aborted) {
+    int context_t::search_qs(int alpha, int beta, const int ply, const std::atomic_bool &aborted, const int depth) {
         nodes++;
 
         if (PV) pv_table_len[ply] = ply;
@@ -372,12 +363,19 @@ namespace pvs {
         if (aborted) {
             return TIMEOUT;
         } else if (ply > MAX_PLY) {
-            return evaluator->evaluate(*board);
+            return evaluate();
         }
 
         if (board->is_material_draw())
             return 0;
 
+        // Replies to the first ply of quiescence search may be in check from a quiet move, so they must search every
+        // evasion instead of standing pat.
+        const bool evading = depth == -1 && board->is_incheck();
+
+        // Each ply of quiescence search does different work, and so only uses results from plies which did as much
+        const int tt_depth = depth == 0 ? tt::QS_CHECKS_DEPTH : evading ? tt::QS_EVASIONS_DEPTH : tt::QS_CAPTURES_DEPTH;
+
         // Probe transposition table
         tt::entry_t h = {};
         if (tt->probe(board->now().hash, h)) {
@@ -385,11 +383,13 @@ namespace pvs {
             stack[ply].eval = h.info.static_eval;
             tt::Bound h_bound = h.bound();
 
-            if (h_bound == tt::LOWER && score >= beta) return score;
-            if (h_bound == tt::UPPER && score <= alpha) return score;
-            if (h_bound == tt::EXACT) return score;
+            if (h.depth() >= tt_depth) {
+                if (h_bound == tt::LOWER && score >= beta) return score;
+                if (h_bound == tt::UPPER && score <= alpha) return score;
+                if (h_bound == tt::EXACT) return score;
+            }
         } else {
-            stack[ply].eval = evaluator->evaluate(*board);
+            stack[ply].eval = evaluate();
         }
 
         // Probe endgame tablebases
@@ -423,31 +423,75 @@ namespace pvs {
             }
         }
 
-        if (stack[ply].eval >= beta) return beta;
-        if (alpha < stack[ply].eval) alpha = stack[ply].eval;
+        // Stand pat. The static evaluation is saved, so that it isn't recomputed if the position is reached again.
+        if (!evading && stack[ply].eval >= beta) {
+            tt->save(tt::LOWER, board->now().hash, tt_depth, ply, stack[ply].eval, beta, EMPTY_MOVE);
+            return beta;
+        }
+
+        const int old_alpha = alpha;
+        move_t best_move = EMPTY_MOVE;
+        if (!evading && alpha < stack[ply].eval) alpha = stack[ply].eval;
 
         GenStage stage = GEN_NONE;
         move_t move{};
         int move_score;
-        movesort_t gen(QUIESCENCE, heur, *board, EMPTY_MOVE, EMPTY_MOVE, 0);
-        while ((move = gen.next(stage, move_score, true)) != EMPTY_MOVE) {
-            if (stack[ply].eval + move_score < alpha - 128) break; // Delta pruning
+        int searched = 0;
+        movesort_t gen(evading ? NORMAL : QUIESCENCE, heur, *board, EMPTY_MOVE, EMPTY_MOVE, 0);
+        while ((move = gen.next(stage, move_score, !evading)) != EMPTY_MOVE) {
+            // Delta pruning. Only captures with a non-negative SEE are generated, so the threshold is only tested when
+            // it is positive.
+            int delta = alpha - 128 - stack[ply].eval;
+            if (!evading && delta > 0 && !board->see_ge(move, delta)) break;
 
             board->move(move);
-            if (board->is_illegal()) {
-                board->unmove();
-                continue;
-            } else {
-                int score = -search_qs<PV>(-beta, -alpha, ply + 1, aborted);
+            searched++;
+            int score = -search_qs<PV>(-beta, -alpha, ply + 1, aborted, depth - 1);
+            board->unmove();
+
+            if (aborted) return TIMEOUT;
+
+            if (score >= beta) {
+                tt->save(tt::LOWER, board->now().hash, tt_depth, ply, stack[ply].eval, beta, move);
+                return beta;
+            }
+            if (score > alpha) {
+                alpha = score;
+                best_move = move;
+
+                if (PV) {
+                    update_pv(ply, move);
+                }
+            }
+        }
+
+        if (evading && searched == 0) {
+            return -TO_MATE_SCORE(ply);
+        }
+
+        // Quiet checks at the first ply, which don't lose material
+        if (depth == 0) {
+            move_t checks[256];
+            movegen_t gen_checks(*board, true);
+            int n_checks = gen_checks.gen_quiet_checks(checks);
+
+            for (int i = 0; i < n_checks; i++) {
+                move = checks[i];
+                if (!board->see_ge(move, 0)) continue;
+
+                board->move(move);
+                int score = -search_qs<PV>(-beta, -alpha, ply + 1, aborted, depth - 1);
                 board->unmove();
 
                 if (aborted) return TIMEOUT;
 
                 if (score >= beta) {
+                    tt->save(tt::LOWER, board->now().hash, tt_depth, ply, stack[ply].eval, beta, move);
                     return beta;
                 }
                 if (score > alpha) {
                     alpha = score;
+                    best_move = move;
 
                     if (PV) {
                         update_pv(ply, move);
@@ -456,6 +500,12 @@ namespace pvs {
             }
         }
 
+        if (alpha > old_alpha) {
+            tt->save(tt::EXACT, board->now().hash, tt_depth, ply, stack[ply].eval, alpha, best_move);
+        } else {
+            tt->save(tt::UPPER, board->now().hash, tt_depth, ply, stack[ply].eval, alpha, EMPTY_MOVE);
+        }
+
         return alpha;
     }
 
@@ -463,7 +513,7 @@ namespace pvs {
         if (aborted) {
             return TIMEOUT;
         } else if (ply > MAX_PLY) {
-            return evaluator->evaluate(*board);
+            return evaluate();
         }
 
         // Quiescence search
@@ -503,9 +553,12 @@ namespace pvs {
             }
 
             tt_move = board->to_move(h.info.move);
+#ifdef TOPPLE_TT_STATS
+            if (tt_move != EMPTY_MOVE && !board->is_pseudo_legal(tt_move)) tt::record_collision();
+#endif
         } else {
             score = -INF;
-            stack[ply].eval = evaluator->evaluate(*board);
+            stack[ply].eval = evaluate();
         }
 
         // Probe endgame tablebases
@@ -589,7 +642,7 @@ namespace pvs {
         movesort_t gen(NORMAL, heur, *board, tt_move, refutation, ply);
         int searched = 0;
         while ((move = gen.next(stage, move_score, skip_quiets)) != EMPTY_MOVE) {
-            if (excluded == move || !board->is_legal(move)) {
+            if (excluded == move) {
                 continue;
             }
 
@@ -646,7 +699,7 @@ namespace pvs {
                 // LMR
                 int R = 1 + depth / 8 + searched / 8 - improving;
                 if (stage == GEN_QUIETS && move_score < 0) R++;
-                if (R >= 1 && board->see(reverse(move)) < 0) R -= 2;
+                if (R >= 1 && !board->see_ge(reverse(move), 0)) R -= 2;
 
                 if (R > 0) {
                     score = -search_zw(1 - beta, ply + 1, depth - R - 1 + ex, aborted);
@@ -7,7 +7,9 @@
 
 #include <atomic>
 #include <vector>
+#include <memory>
 #include <functional>
+#include <algorithm>
 
 #include "types.h"
 #include "board.h"
@@ -16,33 +18,78 @@
 #include "movesort.h"
 
 namespace pvs {
+    // Maximum number of moves in a position
+    constexpr int MAX_MOVES = 256;
+
     class alignas(64) context_t {
         struct stack_entry_t {
             // Initialised upon entering a node
             int eval;
         };
+
+        // Moves of a PV node, with the depths they should be searched to
+        struct pv_move_t {
+            move_t move;
+            int move_number;
+            int reduced_depth;
+            int depth;
+        };
     public:
         // Constructor
-        context_t(board_t *board, evaluator_t *evaluator, tt::hash_t *tt, int use_tb)
-                : board(board), evaluator(evaluator), tt(tt), use_tb(use_tb) {}
+        context_t(board_t *board, evaluator_t *evaluator, eval_cache_t *eval_cache, tt::hash_t *tt, int use_tb)
+                : board(board), evaluator(evaluator), eval_cache(eval_cache), tt(tt), use_tb(use_tb),
+                  move_frames(new pv_move_t[(MAX_PLY + 1) * MAX_MOVES]) {
+            board->reserve(MAX_PLY + 2);
+        }
         context_t() = default;
 
+        /**
+         * Prepare to search the current position of the board. Only the principal variation and statistics are reset:
+         * the search heuristics carry over from the previous search, aged by the number of plies played since.
+         *
+         * @param new_use_tb max pieces before probing tablebases
+         * @param plies number of plies played since the previous search, or -1 if the root position is unrelated
+         */
+        void new_search(int new_use_tb, int plies) {
+            use_tb = new_use_tb;
+            heur.age(plies);
+
+            pv_table_len[0] = 0;
+            saved_pv_len = 0;
+
+            nodes = 0;
+            sel_depth = 0;
+            tb_hits = 0;
+        }
+
+        // Forget the search heuristics, e.g. at the start of a new game
+        void clear_heuristics() {
+            heur = {};
+        }
+
         // Search
-        int search_root(std::vector<move_t> root_moves,
+        int search_root(const std::vector<move_t> &root_moves,
                 const std::function<void(int)> &output_info, const std::function<void(int, move_t)> &output_currmove,
                 int alpha, int beta, int depth, const std::atomic_bool &aborted);
 
-        // Principal variation
-        std::vector<move_t> get_current_pv() {
-            return std::vector<move_t>(pv_table[0], pv_table[0] + pv_table_len[0]);
+        // Principal variation, copied into a buffer of at least MAX_PLY + 1 moves. Returns the number of moves.
+        int get_current_pv(move_t *pv) {
+            std::copy(pv_row(0), pv_row(0) + pv_table_len[0], pv);
+            return pv_table_len[0];
         }
 
-        std::vector<move_t> get_saved_pv() {
-            return saved_pv;
+        int get_saved_pv(move_t *pv) const {
+            std::copy(saved_pv, saved_pv + saved_pv_len, pv);
+            return saved_pv_len;
+        }
+
+        bool has_saved_pv() const {
+            return saved_pv_len > 0;
         }
 
         void save_pv() {
-            saved_pv = get_current_pv();
+            std::copy(pv_row(0), pv_row(0) + pv_table_len[0], saved_pv);
+            saved_pv_len = pv_table_len[0];
         }
 
         board_t *get_board() {
@@ -64,28 +111,55 @@ namespace pvs {
     private:
         int search_pv(int alpha, int beta, int ply, int depth, const std::atomic_bool &aborted);
         template<bool PV>
-        int search_qs(int alpha, int beta, int ply, const std::atomic_bool &aborted);
+        int search_qs(int alpha, int beta, int ply, const std::atomic_bool &aborted, int depth = 0);
         int search_zw(int beta, int ply, int depth, const std::atomic_bool &aborted, move_t excluded = EMPTY_MOVE);
 
+        int evaluate() {
+            int eval;
+            if (!eval_cache->probe(board->now().hash, eval)) {
+                eval = evaluator->evaluate(*board);
+                eval_cache->save(board->now().hash, eval);
+            }
+            return eval;
+        }
+
+        /**
+         * Get the row of the principal variation table for a ply. Only the moves at indices ply to MAX_PLY inclusive
+         * are stored for each ply, so the rows are packed into a triangle half the size of a square table.
+         *
+         * @param ply ply of the row, from 0 to MAX_PLY inclusive
+         * @return pointer such that row[i] is the move at index i of the principal variation from this ply
+         */
+        move_t *pv_row(int ply) {
+            return pv_table + ply * MAX_PLY - ply * (ply - 1) / 2;
+        }
+
         void update_pv(int ply, move_t move) {
-            pv_table[ply][ply] = move;
-            for (int i = ply + 1; i < pv_table_len[ply + 1]; i++) {
-                pv_table[ply][i] = pv_table[ply + 1][i];
+            move_t *row = pv_row(ply);
+            row[ply] = move;
+            if (pv_table_len[ply + 1] > ply + 1) {
+                const move_t *child = pv_row(ply + 1);
+                std::copy(child + ply + 1, child + pv_table_len[ply + 1], row + ply + 1);
             }
             pv_table_len[ply] = pv_table_len[ply + 1];
         }
 
         board_t *board; // Board representation
         evaluator_t *evaluator; // Pointer to shared evaluator
+        eval_cache_t *eval_cache; // Pointer to the evaluation cache of this thread
         tt::hash_t *tt; // Pointer to shared transposition table
         int use_tb; // Max pieces before probing tablebases
 
-        // Principal variation table
-        int pv_table_len[MAX_PLY + 1] = {};
-        move_t pv_table[MAX_PLY + 1][MAX_PLY + 1] = {{}};
+        // Principal variation table, with the row of each ply holding MAX_PLY + 1 - ply moves
+        int pv_table_len[MAX_PLY + 2] = {};
+        move_t pv_table[(MAX_PLY + 1) * (MAX_PLY + 2) / 2] = {};
 
         // Last saved PV
-        std::vector<move_t> saved_pv;
+        int saved_pv_len = 0;
+        move_t saved_pv[MAX_PLY + 1] = {};
+
+        // Move lists of PV nodes, indexed by ply, so that no allocation is needed during the search
+        std::unique_ptr<pv_move_t[]> move_frames;
 
         // Search heuristics
         heuristic_set_t heur;
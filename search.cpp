@@ -11,44 +11,76 @@
 
 search_t::search_t(tt::hash_t *tt, const processed_params_t &params, int threads, bool silent)
         : tt(tt), params(params), limits(nullptr), silent(silent) {
+    root_moves.reserve(pvs::MAX_MOVES);
+    set_threads(threads);
+}
 
-    // Create an evaluator for each thread
-
-    std::function<void(worker_t*)> worker_loop = [this] (worker_t *worker) {
-        while (!worker->terminated) {
-            std::unique_lock<std::mutex> lock(worker->mutex);
-            worker->cv.wait(lock, [worker] () { return worker->searching || worker->terminated; });
-            if (worker->terminated) break;
-            thread_start(worker->context, *worker->aborted, worker);
-            worker->searching = false;
-            worker->promise.set_value();
-        }
-    };
+search_t::~search_t() {
+    set_threads(0);
+}
 
-    for (size_t i = 0; i < threads; i++) {
-        workers.emplace_back(std::make_unique<worker_t>(i, std::ref(params), 8 * MB, std::ref(worker_loop)));
+void search_t::set_threads(size_t threads) {
+    // Create an evaluator for each new thread
+    while (workers.size() < threads) {
+        workers.emplace_back(std::make_unique<worker_t>(workers.size(), std::ref(params), 8 * MB, eval_cache_size, tt,
+                                                        [this] (worker_t *worker) { worker_loop(worker); }));
     }
-}
 
-search_t::~search_t() {
-    for (auto &worker : workers) {
+    // Terminate surplus threads, keeping the remaining workers (and their pawn hash tables) intact
+    while (workers.size() > threads) {
+        std::unique_ptr<worker_t> &worker = workers.back();
         {
             std::lock_guard<std::mutex> lock(worker->mutex);
             worker->terminated = true;
         }
         worker->cv.notify_one();
+        worker->thread.join();
+
+        workers.pop_back();
     }
+}
 
+void search_t::set_eval_cache_size(size_t size) {
+    eval_cache_size = size;
     for (auto &worker : workers) {
-        worker->thread.join();
+        worker->eval_cache.resize(size);
+    }
+}
+
+void search_t::clear_heuristics() {
+    for (auto &worker : workers) {
+        worker->context.clear_heuristics();
     }
+    last_root_ply = SIZE_MAX;
+}
+
+void search_t::worker_loop(worker_t *worker) {
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    while (true) {
+        worker->cv.wait(lock, [worker] () { return worker->searching || worker->terminated; });
+        if (worker->terminated) break;
+
+        // Search without holding the lock, so that think() can wait for the search to finish
+        lock.unlock();
+        thread_start(worker->context, *worker->aborted, worker);
+        lock.lock();
+
+        worker->searching = false;
+        worker->cv.notify_all();
+    }
+}
+
+void search_t::wait_for_worker(worker_t *worker) {
+    std::unique_lock<std::mutex> lock(worker->mutex);
+    worker->cv.wait(lock, [worker] () { return !worker->searching; });
 }
 
 search_result_t search_t::think(board_t &board, const search_limits_t &search_limits, std::atomic_bool &aborted) {
     start = engine_clock::now();
     this->limits = &search_limits;
 
-    // Initialise root moves
+    // Initialise root moves. The search does not allocate from here on: root_moves has space reserved for every
+    // legal move, and the workers are started and joined with their own mutexes and condition variables.
     root_moves.clear();
     {
         move_t buf[192];
@@ -57,7 +89,7 @@ search_result_t search_t::think(board_t &board, const search_limits_t &search_li
 
         // Copy legal moves to root_moves
         std::copy_if(buf, buf + pseudo_legal, std::back_inserter(root_moves),
-                     [board](move_t move) { return board.is_legal(move); });
+                     [&board](move_t move) { return board.is_legal(move); });
 
         // Find intersection of root moves with UCI searchmoves
         if (!search_limits.search_moves.empty()) {
@@ -73,10 +105,11 @@ search_result_t search_t::think(board_t &board, const search_limits_t &search_li
 
     // the UCI searchmoves option overrides tablebase root move filtering
     if (search_limits.search_moves.empty() && pop_count(board.all()) <= tb_largest()) {
-        std::vector<move_t> tb_root_moves = probe_root(board);
+        move_t tb_root_moves[192];
+        size_t tb_moves = probe_root(board, tb_root_moves);
 
-        if (!tb_root_moves.empty()) {
-            root_moves = std::move(tb_root_moves);
+        if (tb_moves > 0) {
+            root_moves.assign(tb_root_moves, tb_root_moves + tb_moves);
             use_tb = 0;
         }
     }
@@ -103,18 +136,23 @@ search_result_t search_t::think(board_t &board, const search_limits_t &search_li
         return {root_moves[0], ponder_move};
     }
 
+    // Count the plies played since the last search, if the game has continued from its root
+    int plies = -1;
+    size_t root_ply = board.history_size() - 1;
+    if (root_ply >= last_root_ply && board.history(last_root_ply).hash == last_root_hash) {
+        plies = int(root_ply - last_root_ply);
+    }
+    last_root_ply = root_ply;
+    last_root_hash = board.now().hash;
+
     // Start workers
-    std::vector<std::future<void>> futures;
     for (auto &worker : workers) {
-        // Initialise worker
-        worker->board = board;
-        worker->context = pvs::context_t(&worker->board, &worker->evaluator, tt, use_tb);
+        // Initialise worker, keeping its search heuristics
+        worker->board.copy_recent(board, MAX_PLY + 2);
+        worker->context.new_search(use_tb, plies);
+        worker->eval_cache.reset_stats();
         worker->aborted = &aborted;
 
-        std::promise<void> promise = std::promise<void>();
-        futures.push_back(promise.get_future());
-        worker->promise = std::move(promise);
-
         // Notify worker thread
         {
             std::lock_guard<std::mutex> lock(worker->mutex);
@@ -127,31 +165,34 @@ search_result_t search_t::think(board_t &board, const search_limits_t &search_li
     wait_for_timer();
 
     // Limit time for main thread
-#ifdef TOPPLE_TUNE
-    futures[0].wait();
-#else
-    if (futures[0].wait_for(std::chrono::milliseconds(search_limits.hard_time_limit)) !=
-        std::future_status::ready) {
-        aborted = true;
-        futures[0].wait();
+#ifndef TOPPLE_TUNE
+    {
+        worker_t *main_worker = workers[0].get();
+        std::unique_lock<std::mutex> lock(main_worker->mutex);
+        if (!main_worker->cv.wait_for(lock, std::chrono::milliseconds(search_limits.hard_time_limit),
+                                      [main_worker] () { return !main_worker->searching; })) {
+            aborted = true;
+        }
     }
 #endif
+    wait_for_worker(workers[0].get());
 
     // Then abort and wait for all the helper threads
     aborted = true;
     for (size_t tid = 1; tid < workers.size(); tid++) {
-        futures[tid].wait();
+        wait_for_worker(workers[tid].get());
     }
 
     // Read the PV
-    std::vector<move_t> pv = workers[0]->context.get_saved_pv();
-    if (pv.empty()) {
+    move_t pv[MAX_PLY + 1];
+    int pv_len = workers[0]->context.get_saved_pv(pv);
+    if (pv_len == 0) {
         std::cerr << "warn: insufficient time to search to depth 1" << std::endl;
         return {EMPTY_MOVE, EMPTY_MOVE};
     }
 
     // If we don't have a ponder move (e.g. if we're currently failing high but the search was aborted), look in the tt.
-    if (pv.size() == 1) {
+    if (pv_len == 1) {
         board.move(pv[0]);
 
         tt::entry_t h = {};
@@ -162,7 +203,7 @@ search_result_t search_t::think(board_t &board, const search_limits_t &search_li
 
         board.unmove();
 
-        pv.push_back(ponder_move);
+        pv[1] = ponder_move;
     }
 
     return {pv[0], pv[1]};
@@ -247,14 +288,14 @@ int search_t::search_aspiration(pvs::context_t &context, int prev_score, int dep
         assert(alpha <= beta);
 
         if (!silent && tid == 0 && time > 1000) {
-            score = context.search_root(root_moves,
-                                        [this, &context, tid, depth, &aborted](int score) {
-                                            print_stats(*context.get_board(), score, depth, tt::EXACT, aborted);
-                                        },
-                                        [](int num, move_t move) {
-                                            std::cout << "info currmove " << move << " currmovenumber " << num
-                                                      << std::endl;
-                                        },
+            // Pass the output callbacks by reference, so that std::function does not allocate
+            auto output_info = [this, &context, depth, &aborted](int score) {
+                print_stats(*context.get_board(), score, depth, tt::EXACT, aborted);
+            };
+            auto output_currmove = [](int num, move_t move) {
+                std::cout << "info currmove " << move << " currmovenumber " << num << std::endl;
+            };
+            score = context.search_root(root_moves, std::ref(output_info), std::ref(output_currmove),
                                         alpha, beta, depth, aborted);
         } else {
             score = context.search_root(root_moves, nullptr, nullptr, alpha, beta, depth, aborted);
@@ -291,7 +332,7 @@ int search_t::search_aspiration(pvs::context_t &context, int prev_score, int dep
 }
 
 bool search_t::keep_searching(int depth) {
-    return workers[0]->context.get_saved_pv().empty()
+    return !workers[0]->context.has_saved_pv()
             || ((limits->node_limit == UINT64_MAX || count_nodes() <= limits->node_limit)
             && depth <= limits->depth_limit
             && (!timer_started || CHRONO_DIFF(timer_start, engine_clock::now()) <= limits->hard_time_limit));
@@ -306,6 +347,24 @@ U64 search_t::count_nodes() {
     return total_nodes;
 }
 
+U64 search_t::count_eval_cache_hits() {
+    U64 total_hits = 0;
+    for (auto &worker : workers) {
+        total_hits += worker->eval_cache.get_hits();
+    }
+
+    return total_hits;
+}
+
+U64 search_t::count_eval_cache_probes() {
+    U64 total_probes = 0;
+    for (auto &worker : workers) {
+        total_probes += worker->eval_cache.get_probes();
+    }
+
+    return total_probes;
+}
+
 U64 search_t::count_tb_hits() {
     U64 total_tb_hits = 0;
     for (auto &worker : workers) {
@@ -320,7 +379,8 @@ void search_t::print_stats(board_t &pos, int score, int depth, tt::Bound bound,
     auto time = CHRONO_DIFF(start, engine_clock::now());
 
     // Get an appropriate PV
-    std::vector<move_t> pv = bound == tt::EXACT ? workers[0]->context.get_current_pv() : workers[0]->context.get_saved_pv();
+    move_t pv[MAX_PLY + 1];
+    int pv_len = bound == tt::EXACT ? workers[0]->context.get_current_pv(pv) : workers[0]->context.get_saved_pv(pv);
 
     auto sel_depth = size_t(workers[0]->context.get_sel_depth());
     std::cout << "info depth " << depth << " seldepth " << sel_depth;
@@ -347,8 +407,8 @@ void search_t::print_stats(board_t &pos, int score, int depth, tt::Bound bound,
                   << " tbhits " << count_tb_hits();
     }
     std::cout << " pv ";
-    for (const auto &move : pv) {
-        std::cout << move << " ";
+    for (int i = 0; i < pv_len; i++) {
+        std::cout << pv[i] << " ";
     }
 
     std::cout << std::endl;
@@ -7,7 +7,8 @@
 #ifndef TOPPLE_SEARCH_H
 #define TOPPLE_SEARCH_H
 
-#include <future>
+#include <thread>
+#include <functional>
 #include <algorithm>
 #include <cstring>
 #include <chrono>
@@ -72,21 +73,27 @@ class search_t {
     struct worker_t {
         size_t tid;
         evaluator_t evaluator;
+        eval_cache_t eval_cache;
 
         board_t board;
         pvs::context_t context;
         std::atomic_bool *aborted = nullptr;
 
         std::thread thread;
-        std::promise<void> promise;
 
+        // Set by think() to start a search, and cleared by the worker when the search is over
         bool searching = false;
         bool terminated = false;
         std::mutex mutex;
         std::condition_variable cv;
 
-        worker_t(size_t tid, const processed_params_t &eval_params, size_t pawn_hash_size, const std::function<void(worker_t*)>& runnable) :
-            tid(tid), evaluator(eval_params, pawn_hash_size) {
+        worker_t(size_t tid, const processed_params_t &eval_params, size_t pawn_hash_size, size_t eval_cache_size,
+                 tt::hash_t *tt, const std::function<void(worker_t*)>& runnable) :
+            tid(tid), evaluator(eval_params, pawn_hash_size), eval_cache(eval_cache_size),
+            context(&board, &evaluator, &eval_cache, tt, 0) {
+            // Make room for the (at most 101) records copied by copy_recent() under the fifty move rule, as well as
+            // the search itself, so that starting a search does not allocate
+            board.reserve(101 + MAX_PLY + 2);
             thread = std::thread(runnable, this);
         }
         worker_t(const worker_t &) = delete;
@@ -98,16 +105,51 @@ public:
     search_t(const search_t&&) = delete;
 
     search_result_t think(board_t &board, const search_limits_t &limits, std::atomic_bool &aborted);
+
+    /**
+     * Grow or shrink the pool of search threads in place. Must not be called during a search.
+     *
+     * @param threads new number of search threads
+     */
+    void set_threads(size_t threads);
+
+    /**
+     * Resize and clear the evaluation cache of every search thread. Must not be called during a search.
+     *
+     * @param size new size of each cache in bytes
+     */
+    void set_eval_cache_size(size_t size);
+
+    /**
+     * Forget the move ordering heuristics of every search thread, which otherwise carry over to the next search.
+     * Must not be called during a search.
+     */
+    void clear_heuristics();
+
+    /**
+     * Sum evaluation cache statistics over all search threads, for the last search
+     */
+    U64 count_eval_cache_hits();
+    U64 count_eval_cache_probes();
+
+    /**
+     * Count the nodes searched by all threads in the current (or last) search
+     *
+     * @return number of nodes
+     */
+    U64 count_nodes();
+
     void enable_timer();
     void wait_for_timer();
     void reset_timer();
 private:
+    void worker_loop(worker_t *worker);
+    void wait_for_worker(worker_t *worker);
     void thread_start(pvs::context_t &context, const std::atomic_bool &aborted, worker_t *worker);
     int search_aspiration(pvs::context_t &context, int prev_score, int depth, const std::atomic_bool &aborted, size_t tid);
 
     bool keep_searching(int depth);
 
-    U64 count_nodes();
     U64 count_tb_hits();
     void print_stats(board_t &board, int score, int depth, tt::Bound bound, const std::atomic_bool &aborted);
 
@@ -119,8 +161,13 @@ private:
     search_limits_t const *limits;
     std::vector<move_t> root_moves;
 
+    // Root of the last search, to find the number of plies played before the next one
+    size_t last_root_ply = SIZE_MAX;
+    U64 last_root_hash = 0;
+
     // Workers
     std::vector<std::unique_ptr<worker_t>> workers;
+    size_t eval_cache_size = 256 * 1024;
 
     // Timing
     std::mutex timer_mtx;
@@ -58,7 +58,7 @@ void init_tb(const std::string &path) {
         throw std::runtime_error("failed to initialise syzygy tablebases");
 }
 
-std::vector<move_t> probe_root(const board_t &board) {
+size_t probe_root(const board_t &board, move_t *moves) {
     unsigned results[TB_MAX_MOVES];
     unsigned result = tb_probe_root(
             board.side(WHITE), board.side(BLACK),
@@ -69,25 +69,25 @@ std::vector<move_t> probe_root(const board_t &board) {
             board.pieces(WHITE, KNIGHT) | board.pieces(BLACK, KNIGHT),
             board.pieces(WHITE, PAWN) | board.pieces(BLACK, PAWN),
             board.now().halfmove_clock,
-            board.now().castle[WHITE][0] * TB_CASTLING_K
-            | board.now().castle[WHITE][1] * TB_CASTLING_Q
-            | board.now().castle[BLACK][0] * TB_CASTLING_k
-            | board.now().castle[BLACK][1] * TB_CASTLING_q,
+            board.now().can_castle(WHITE, 0) * TB_CASTLING_K
+            | board.now().can_castle(WHITE, 1) * TB_CASTLING_Q
+            | board.now().can_castle(BLACK, 0) * TB_CASTLING_k
+            | board.now().can_castle(BLACK, 1) * TB_CASTLING_q,
             board.now().ep_square,
             board.now().next_move == WHITE,
             results
     );
 
     WDL best_wdl = read_wdl(result);
-    std::vector<move_t> moves;
+    size_t count = 0;
 
     for (unsigned *r = results; *r != TB_RESULT_FAILED; ++r) {
         if (read_wdl(*r) == best_wdl) {
-            moves.push_back(board.to_move(read_move(*r)));
+            moves[count++] = board.to_move(read_move(*r));
         }
     }
 
-    return moves;
+    return count;
 }
 
 std::optional<WDL> probe_wdl(const board_t &board) {
@@ -100,10 +100,10 @@ std::optional<WDL> probe_wdl(const board_t &board) {
             board.pieces(WHITE, KNIGHT) | board.pieces(BLACK, KNIGHT),
             board.pieces(WHITE, PAWN) | board.pieces(BLACK, PAWN),
             board.now().halfmove_clock,
-            board.now().castle[WHITE][0] * TB_CASTLING_K
-            | board.now().castle[WHITE][1] * TB_CASTLING_Q
-            | board.now().castle[BLACK][0] * TB_CASTLING_k
-            | board.now().castle[BLACK][1] * TB_CASTLING_q,
+            board.now().can_castle(WHITE, 0) * TB_CASTLING_K
+            | board.now().can_castle(WHITE, 1) * TB_CASTLING_Q
+            | board.now().can_castle(BLACK, 0) * TB_CASTLING_k
+            | board.now().can_castle(BLACK, 1) * TB_CASTLING_q,
             board.now().ep_square,
             board.now().next_move == WHITE
     );
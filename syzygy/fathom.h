@@ -5,7 +5,6 @@
 #ifndef TOPPLE_FATHOM_H
 #define TOPPLE_FATHOM_H
 
-#include <vector>
 #include <optional>
 #include <string>
 
@@ -33,10 +32,10 @@ unsigned tb_largest();
 void init_tb(const std::string &path);
 
 /**
- * Probe the DTZ table, returning a vector of candidate moves which preserve the WDL value.
- * An empty vector indicates failure. Not thread safe - only call at start of search.
+ * Probe the DTZ table, writing the candidate moves which preserve the WDL value to a buffer with room for every legal
+ * move. Returns the number of candidate moves, or 0 on failure. Not thread safe - only call at start of search.
  */
-std::vector<move_t> probe_root(const board_t &board);
+size_t probe_root(const board_t &board, move_t *moves);
 
 /**
  * Probe the WDL table, returning a WDL state. Thread safe, designed to be used during search.
@@ -0,0 +1,105 @@
+#include <catch2/catch.hpp>
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "../bench.h"
+#include "../search.h"
+
+// Count every allocation made by this test binary, which is separate so that other tests use the usual allocator
+namespace {
+    std::atomic<size_t> allocations = 0;
+}
+
+void *operator new(std::size_t size) {
+    allocations++;
+    if (void *ptr = std::malloc(size ? size : 1)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept {
+    std::free(ptr);
+}
+
+// Over-aligned types such as board records and search contexts use the aligned overloads
+void *operator new(std::size_t size, std::align_val_t align) {
+    allocations++;
+    auto alignment = static_cast<std::size_t>(align);
+    size = (std::max(size, std::size_t(1)) + alignment - 1) & ~(alignment - 1); // aligned_alloc needs a multiple
+    if (void *ptr = std::aligned_alloc(alignment, size)) return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *ptr, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept {
+    std::free(ptr);
+}
+
+TEST_CASE("Search allocations") {
+    processed_params_t params = processed_params_t(eval_params_t());
+    tt::hash_t tt(4 * MB);
+
+    SECTION("Principal variation search does not allocate") {
+        evaluator_t evaluator(params, 1 * MB);
+        eval_cache_t eval_cache(1 * MB);
+
+        for (size_t i = 0; i < bench_positions.size(); i += 5) {
+            board_t board(bench_positions[i]);
+
+            move_t buf[256];
+            movegen_t gen(board, true);
+            std::vector<move_t> root_moves(buf, buf + gen.gen_normal(buf));
+
+            auto context = std::make_unique<pvs::context_t>(&board, &evaluator, &eval_cache, &tt, 0);
+            std::atomic_bool aborted = false;
+
+            size_t before = allocations;
+            for (int depth = 1; depth <= 8; depth++) {
+                context->search_root(root_moves, nullptr, nullptr, -INF, INF, depth, aborted);
+                context->save_pv();
+            }
+            size_t searching = allocations - before;
+
+            INFO(bench_positions[i]);
+            REQUIRE(searching == 0);
+        }
+    }
+
+    SECTION("Searching does not allocate") {
+        search_t search(&tt, params, 2, false);
+
+        // Discard the search output, which is still formatted as usual
+        struct : std::streambuf {
+            int overflow(int c) override { return c; }
+        } discard;
+        std::streambuf *output = std::cout.rdbuf(&discard);
+
+        std::vector<size_t> searching;
+        for (size_t i = 0; i < bench_positions.size(); i += 10) {
+            board_t board(bench_positions[i]);
+            search_limits_t limits(INT_MAX, 8, UINT64_MAX, std::vector<move_t>());
+            std::atomic_bool aborted = false;
+
+            search.enable_timer();
+            size_t before = allocations;
+            search.think(board, limits, aborted);
+            searching.push_back(allocations - before);
+            search.reset_timer();
+        }
+
+        std::cout.rdbuf(output);
+        REQUIRE(searching == std::vector<size_t>(searching.size(), 0));
+    }
+}
@@ -2,6 +2,8 @@
 // Created by Vincent on 27/09/2017.
 //
 
+#include <random>
+
 #include <catch2/catch.hpp>
 
 #include "util.h"
@@ -720,6 +722,26 @@ TEST_CASE("Bitboard engine") {
         }
     }
 
+    SECTION("Slider lookup methods agree") {
+        std::mt19937_64 gen(0);
+        bool use_pext = bb_sliders::use_pext;
+
+        for (int i = 0; i < 100000; i++) {
+            uint8_t square = gen() % 64;
+            U64 occupied = gen() & gen(); // Around a quarter of the squares
+
+            bb_sliders::use_pext = false;
+            U64 bishop = find_moves<BISHOP>(WHITE, square, occupied);
+            U64 rook = find_moves<ROOK>(WHITE, square, occupied);
+
+            bb_sliders::use_pext = true;
+            REQUIRE(find_moves<BISHOP>(WHITE, square, occupied) == bishop);
+            REQUIRE(find_moves<ROOK>(WHITE, square, occupied) == rook);
+        }
+
+        bb_sliders::use_pext = use_pext;
+    }
+
     SECTION("Utility") {
         REQUIRE(E4 + rel_offset(WHITE, D_N) == E5);
         REQUIRE(E5 + rel_offset(BLACK, D_N) == E4);
@@ -14,10 +14,10 @@ TEST_CASE("Board representation") {
     SECTION("Initialised correctly") {
         REQUIRE(board.now().next_move == WHITE);
         REQUIRE(board.now().ep_square == 0);
-        REQUIRE(board.now().castle[0][0] == 1);
-        REQUIRE(board.now().castle[0][1] == 1);
-        REQUIRE(board.now().castle[1][0] == 1);
-        REQUIRE(board.now().castle[1][1] == 1);
+        REQUIRE(board.now().can_castle(WHITE, 0));
+        REQUIRE(board.now().can_castle(WHITE, 1));
+        REQUIRE(board.now().can_castle(BLACK, 0));
+        REQUIRE(board.now().can_castle(BLACK, 1));
         REQUIRE(board.now().halfmove_clock == 0);
 
         expected = c_u64({1, 1, 1, 1, 1, 1, 1, 1,
@@ -181,10 +181,10 @@ TEST_CASE("Board representation") {
 
         REQUIRE(board.now().next_move == BLACK);
         REQUIRE(board.now().ep_square == E3);
-        REQUIRE(board.now().castle[0][0] == 1);
-        REQUIRE(board.now().castle[0][1] == 1);
-        REQUIRE(board.now().castle[1][0] == 1);
-        REQUIRE(board.now().castle[1][1] == 1);
+        REQUIRE(board.now().can_castle(WHITE, 0));
+        REQUIRE(board.now().can_castle(WHITE, 1));
+        REQUIRE(board.now().can_castle(BLACK, 0));
+        REQUIRE(board.now().can_castle(BLACK, 1));
         REQUIRE(board.now().halfmove_clock == 0);
 
         expected = c_u64({1, 1, 1, 1, 1, 1, 1, 1,
@@ -204,10 +204,10 @@ TEST_CASE("Board representation") {
         // Recheck original position
         REQUIRE(board.now().next_move == WHITE);
         REQUIRE(board.now().ep_square == 0);
-        REQUIRE(board.now().castle[0][0] == 1);
-        REQUIRE(board.now().castle[0][1] == 1);
-        REQUIRE(board.now().castle[1][0] == 1);
-        REQUIRE(board.now().castle[1][1] == 1);
+        REQUIRE(board.now().can_castle(WHITE, 0));
+        REQUIRE(board.now().can_castle(WHITE, 1));
+        REQUIRE(board.now().can_castle(BLACK, 0));
+        REQUIRE(board.now().can_castle(BLACK, 1));
         REQUIRE(board.now().halfmove_clock == 0);
 
         expected = c_u64({1, 1, 1, 1, 1, 1, 1, 1,
@@ -221,6 +221,38 @@ TEST_CASE("Board representation") {
         REQUIRE(board.all() == expected);
         REQUIRE(board.sq(E2).occupied());
     }
+
+    SECTION("Game history") {
+        // 1. e4 e5, then shuffle knights back and forth, growing the record stack past its initial capacity
+        board.move(board.parse_move("e2e4"));
+        board.move(board.parse_move("e7e5"));
+        for (int i = 0; i < 10; i++) {
+            board.move(board.parse_move("g1f3"));
+            board.move(board.parse_move("g8f6"));
+            board.move(board.parse_move("f3g1"));
+            board.move(board.parse_move("f6g8"));
+        }
+        REQUIRE(board.history_size() == 43);
+        REQUIRE(board.now().halfmove_clock == 40);
+        REQUIRE(board.is_repetition_draw(0));
+
+        // A plain copy keeps the whole game
+        board_t copy = board;
+        REQUIRE(copy.history_size() == 43);
+        REQUIRE(copy.now().hash == board.now().hash);
+
+        // A copy for searching only keeps the positions since the last pawn move
+        board_t recent;
+        recent.copy_recent(board, MAX_PLY);
+        REQUIRE(recent.history_size() == 41);
+        REQUIRE(recent.now().hash == board.now().hash);
+        REQUIRE(recent.all() == board.all());
+        REQUIRE(recent.is_repetition_draw(0));
+
+        recent.move(recent.parse_move("g1f3"));
+        recent.unmove();
+        REQUIRE(recent.now().hash == board.now().hash);
+    }
 }
 
 TEST_CASE("Legality") {
@@ -4,6 +4,15 @@
 
 #include <catch2/catch.hpp>
 #include <random>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "util.h"
 #include "../board.h"
@@ -49,4 +58,242 @@ TEST_CASE("Material hashes") {
     data.dec(WHITE, PAWN);
 
     REQUIRE(data.hash() == 0);
-}
\ No newline at end of file
+}
+
+TEST_CASE("Bucket distribution") {
+    std::mt19937_64 gen(0);
+
+    for (size_t n : {size_t(3), size_t(1000), size_t(3000), size_t(49152), size_t(65536)}) {
+        const size_t samples = n * 64;
+        std::vector<size_t> counts(n);
+
+        size_t max_index = 0;
+        for (size_t i = 0; i < samples; i++) {
+            size_t index = tt::bucket_index(gen(), n);
+            max_index = std::max(max_index, index);
+            if (index < n) counts[index]++;
+        }
+        REQUIRE(max_index == n - 1);
+
+        // Pearson's chi-squared statistic has mean n - 1 and variance 2(n - 1) for a uniform distribution
+        double expected = double(samples) / n;
+        double chi_squared = 0;
+        for (size_t count : counts) {
+            chi_squared += (count - expected) * (count - expected) / expected;
+        }
+
+        INFO("n = " << n << ", chi squared = " << chi_squared);
+        REQUIRE(chi_squared < (n - 1) + 6 * std::sqrt(2.0 * (n - 1)) + 10);
+    }
+}
+
+TEST_CASE("Non power of two table") {
+    std::mt19937_64 gen(0);
+    tt::hash_t hash(3 * MB);
+
+    std::vector<U64> hashes(1000);
+    for (U64 &h : hashes) {
+        h = gen();
+        hash.save(tt::EXACT, h, 10, 0, 0, 0, EMPTY_MOVE);
+    }
+
+    for (U64 h : hashes) {
+        tt::entry_t entry = {};
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.depth() == 10);
+        REQUIRE(entry.bound() == tt::EXACT);
+    }
+}
+
+TEST_CASE("Bucket integrity") {
+    std::mt19937_64 gen(0);
+    tt::bucket_t bucket = {};
+
+    for (size_t i = 0; i < tt::bucket_t::size; i++) {
+        REQUIRE(!bucket.matches(i, gen()));
+    }
+
+    std::vector<U64> hashes(tt::bucket_t::size);
+    for (size_t i = 0; i < tt::bucket_t::size; i++) {
+        hashes[i] = gen();
+
+        tt::entry_t entry = {};
+        entry.info.static_eval = int16_t(i);
+        entry.info.internal_value = int16_t(-i);
+        entry.info.about = (5u << 10u) | (uint16_t(tt::LOWER) << 8u) | uint16_t(i + 1 + tt::DEPTH_OFFSET);
+        entry.coded_hash = hashes[i] ^ entry.data;
+        bucket.set(i, hashes[i], entry);
+    }
+
+    for (size_t i = 0; i < tt::bucket_t::size; i++) {
+        REQUIRE(bucket.matches(i, hashes[i]));
+        bucket.refresh(i, 7);
+        REQUIRE(bucket.matches(i, hashes[i]));
+
+        tt::entry_t entry = bucket.get(i, hashes[i]);
+        REQUIRE((entry.coded_hash ^ entry.data) == hashes[i]);
+        REQUIRE(entry.generation() == 7);
+        REQUIRE(entry.bound() == tt::LOWER);
+        REQUIRE(entry.depth() == int(i + 1));
+        REQUIRE(entry.info.static_eval == int16_t(i));
+    }
+
+    // Other positions should only match by (rare) key collisions
+    size_t false_matches = 0;
+    for (size_t n = 0; n < 10000; n++) {
+        U64 other = gen();
+        for (size_t i = 0; i < tt::bucket_t::size; i++) {
+            if (bucket.matches(i, other)) false_matches++;
+        }
+    }
+    REQUIRE(false_matches <= 10);
+}
+
+TEST_CASE("Snapshot") {
+    std::mt19937_64 gen(0);
+    tt::hash_t hash(2 * MB);
+
+    std::vector<U64> hashes(10000);
+    for (U64 &h : hashes) {
+        h = gen();
+        hash.save(tt::LOWER, h, 7, 0, 0, 100, EMPTY_MOVE);
+    }
+
+    const std::string path = "test_hash_snapshot.tt";
+    REQUIRE(hash.dump(path));
+
+    SECTION("Restore") {
+        tt::hash_t restored(2 * MB);
+        restored.age();
+        REQUIRE(restored.load(path));
+
+        // The generation is restored along with the entries
+        REQUIRE(restored.hash_full() == hash.hash_full());
+        REQUIRE(restored.hash_full() > 0);
+
+        for (U64 h : hashes) {
+            tt::entry_t entry = {};
+            REQUIRE(restored.probe(h, entry));
+            REQUIRE(entry.depth() == 7);
+            REQUIRE(entry.bound() == tt::LOWER);
+            REQUIRE(entry.value(0) == 100);
+        }
+    }
+
+    SECTION("Reject different size") {
+        tt::hash_t other(4 * MB);
+        REQUIRE(!other.load(path));
+    }
+
+    std::remove(path.c_str());
+}
+
+#ifdef __linux__
+TEST_CASE("Shared table") {
+    const std::string name = "/topple_test_shared_table";
+    auto segment_exists = [&] () {
+        int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if (fd != -1) close(fd);
+        return fd != -1;
+    };
+
+    tt::hash_t first(MB), second(MB);
+    first.set_shared(name);
+    second.set_shared(name);
+    REQUIRE(first.is_shared());
+    REQUIRE(second.is_shared());
+
+    // Entries and the generation are seen by both tables
+    first.save(tt::EXACT, 12345, 5, 0, 0, 42, EMPTY_MOVE);
+    second.age();
+
+    tt::entry_t entry = {};
+    REQUIRE(second.probe(12345, entry));
+    REQUIRE(entry.value(0) == 42);
+
+    first.save(tt::EXACT, 23456, 5, 0, 0, 7, EMPTY_MOVE);
+    REQUIRE(second.probe(23456, entry));
+    REQUIRE(entry.generation() == 2);
+
+    // The segment is removed when the last table detaches
+    first.set_shared("");
+    REQUIRE(!first.is_shared());
+    REQUIRE(segment_exists());
+    second.set_shared("");
+    REQUIRE(!segment_exists());
+}
+#endif
+
+TEST_CASE("Quiescence search depths") {
+    std::mt19937_64 gen(0);
+    tt::hash_t hash(MB);
+    tt::entry_t entry = {};
+
+    SECTION("Negative depths are stored") {
+        U64 h = gen();
+        hash.save(tt::UPPER, h, tt::QS_CAPTURES_DEPTH, 0, 0, -50, EMPTY_MOVE);
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.depth() == tt::QS_CAPTURES_DEPTH);
+        REQUIRE(entry.bound() == tt::UPPER);
+    }
+
+    SECTION("Shallower quiescence plies do not replace deeper ones") {
+        U64 h = gen();
+        hash.save(tt::LOWER, h, tt::QS_CHECKS_DEPTH, 0, 0, 100, EMPTY_MOVE);
+        hash.save(tt::EXACT, h, tt::QS_CAPTURES_DEPTH, 0, 0, 20, EMPTY_MOVE);
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.depth() == tt::QS_CHECKS_DEPTH);
+        REQUIRE(entry.value(0) == 100);
+
+        hash.save(tt::UPPER, h, tt::QS_CHECKS_DEPTH, 0, 0, 30, EMPTY_MOVE);
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.bound() == tt::UPPER);
+        REQUIRE(entry.value(0) == 30);
+    }
+
+    SECTION("Quiescence search does not replace main search") {
+        U64 h = gen();
+        hash.save(tt::LOWER, h, 1, 0, 0, 100, EMPTY_MOVE);
+        hash.save(tt::EXACT, h, tt::QS_CHECKS_DEPTH, 0, 0, 20, EMPTY_MOVE);
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.depth() == 1);
+    }
+
+    SECTION("Depths are clamped to the stored range") {
+        U64 h = gen();
+        hash.save(tt::EXACT, h, MAX_PLY, 0, 0, 0, EMPTY_MOVE);
+        REQUIRE(hash.probe(h, entry));
+        REQUIRE(entry.depth() == tt::MAX_DEPTH);
+    }
+}
+
+TEST_CASE("Generation wrapping") {
+    std::mt19937_64 gen(0);
+    tt::hash_t hash(MB);
+    const size_t n = MB / sizeof(tt::bucket_t);
+
+    // Generate hashes which all fall into the first bucket
+    auto next_hash = [&] () {
+        U64 h;
+        do h = gen(); while (tt::bucket_index(h, n) != 0);
+        return h;
+    };
+
+    // Fill the bucket with deep entries from every generation in turn. Each generation must replace the
+    // entries from the previous one, even after the generation counter wraps around.
+    for (int search = 0; search < 64 * 20; search++) {
+        std::vector<U64> current(tt::bucket_t::size);
+        for (size_t i = 0; i < tt::bucket_t::size; i++) {
+            current[i] = next_hash();
+            hash.save(tt::EXACT, current[i], 1 + i, 0, 0, 0, EMPTY_MOVE);
+        }
+
+        for (size_t i = 0; i < tt::bucket_t::size; i++) {
+            tt::entry_t entry = {};
+            REQUIRE(hash.probe(current[i], entry));
+            REQUIRE(entry.depth() == int(1 + i));
+        }
+
+        hash.age();
+    }
+}
@@ -2,12 +2,15 @@
 // Created by Vincent on 30/09/2017.
 //
 
+#include <algorithm>
+
 #include "catch2/catch.hpp"
 
 #include "util.h"
 #include "../board.h"
 #include "../movegen.h"
 #include "../eval.h"
+#include "../perft.h"
 
 bool operator==(const board_t& lhs, const board_t& rhs) {
     for(uint8_t sq = 0; sq < 64; sq++) {
@@ -53,7 +56,7 @@ void hash_check(const board_t &board) {
 
     for(int i = 0; i < 2; i++) {
         for(int j = 0; j < 2; j++) {
-            if(board.now().castle[i][j]) hash ^= zobrist::castle[i][j];
+            if(board.now().can_castle(Team(i), j)) hash ^= zobrist::castle[i][j];
         }
     }
 
@@ -102,6 +105,39 @@ U64 perft(board_t &board, int depth) {
     move_t buf[256] = {}; gen.gen_normal(buf);
     int idx = 0;
 
+    // The legal move generator must produce exactly the legal subset of the pseudo-legal moves
+    movegen_t legal_gen(board, true);
+    move_t legal_buf[256] = {};
+    int n_legal = legal_gen.gen_normal(legal_buf);
+    for (int i = 0; i < n_legal; i++) {
+        REQUIRE(std::find(buf, buf + 256, legal_buf[i]) != buf + 256);
+        REQUIRE(board.is_legal(legal_buf[i]));
+    }
+    REQUIRE(n_legal == std::count_if(buf, buf + 256, [&board](move_t move) {
+        return move != EMPTY_MOVE && board.is_legal(move);
+    }));
+
+    // The quiet check generator must produce exactly the quiet legal moves which give check
+    move_t checks_buf[256] = {};
+    int n_checks = legal_gen.gen_quiet_checks(checks_buf);
+    for (int i = 0; i < n_checks; i++) {
+        REQUIRE(std::find(legal_buf, legal_buf + n_legal, checks_buf[i]) != legal_buf + n_legal);
+        REQUIRE(board.gives_check(checks_buf[i]));
+    }
+    REQUIRE(n_checks == std::count_if(legal_buf, legal_buf + n_legal, [&board](move_t move) {
+        return !move.info.is_capture && !move.info.is_promotion && !move.info.castle && board.gives_check(move);
+    }));
+
+    // When in check, the evasion generator must produce the same moves
+    if (legal_gen.in_check()) {
+        move_t evasion_buf[256] = {};
+        int n_evasions = legal_gen.gen_evasions(evasion_buf);
+        REQUIRE(n_evasions == n_legal);
+        for (int i = 0; i < n_evasions; i++) {
+            REQUIRE(std::find(legal_buf, legal_buf + n_legal, evasion_buf[i]) != legal_buf + n_legal);
+        }
+    }
+
     while ((next = buf[idx++]) != EMPTY_MOVE) {
         //INFO(next);
         REQUIRE(board.is_pseudo_legal(next));
@@ -195,3 +231,33 @@ TEST_CASE("Perft: r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1
     board_t board("r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - -");
     REQUIRE(perft(board, 4) == 3894594);
 }
+
+TEST_CASE("Hashed perft") {
+    perft_t perft(16 * MB, 2);
+
+    SECTION("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -") {
+        board_t board("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -");
+        REQUIRE(perft.count(board, 5) == 4865609);
+        REQUIRE(perft.total(board, 5) == 4865609);
+    }
+
+    SECTION("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -") {
+        board_t board("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq -");
+        REQUIRE(perft.total(board, 4) == 4085603);
+    }
+
+    SECTION("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -") {
+        board_t board("8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - -");
+        REQUIRE(perft.total(board, 6) == 11030083);
+    }
+
+    SECTION("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq -") {
+        board_t board("r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq -");
+        REQUIRE(perft.total(board, 4) == 422333);
+    }
+
+    SECTION("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8") {
+        board_t board("rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8");
+        REQUIRE(perft.total(board, 4) == 2103487);
+    }
+}
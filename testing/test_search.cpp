@@ -0,0 +1,54 @@
+#include <catch2/catch.hpp>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "../bench.h"
+#include "../search.h"
+
+TEST_CASE("Principal variation") {
+    processed_params_t params = processed_params_t(eval_params_t());
+    evaluator_t evaluator(params, 1 * MB);
+
+    // Principal variations found at depth 7, which must not change with the layout of the principal variation table
+    const std::vector<std::string> expected = {
+        "b1c3 b8c6 g1f3 g8f6 d2d3 e7e6 c1e3",
+        "c3d5 e7d8 c2c3 c5a7 c4b3 c6a5 g5f6 g7f6",
+        "d4e6 f7e6 d5b6 a7b6 a2a3 b8e8 f2f3",
+        "e3g3 c7e5 f4g4 f6g4 g3g4 e5b2 a1f1 b2a2",
+        "e8e7 h2h3 h8a8 b5b2 h7h6 b1a1 e7d7 a2a4",
+        "a5a6 b3b8 a6a7 b8a8 g1g2 g8f8 g2f3 h7h5",
+        "c6b7 f1e2 b7c8 e2f1 d6e5 f1e2 d7d5 e4d5 e5d5",
+        "d1d3 h7g8 d3d8 g8h7 d8b6 h2g1 b6c7 h4h3 c7f4",
+        "c2d2 b7b5 d2c2 b5b4 c2b2 b4b3 f2f4",
+        "d1c2 h1g2 f5e3 g2f2 e3c4 f2f3 c4a3 f3f2 c1d3 f2e2"
+    };
+
+    for (size_t i = 0; i < expected.size(); i++) {
+        tt::hash_t tt(4 * MB);
+        eval_cache_t eval_cache(1 * MB);
+        board_t board(bench_positions[i * 5]);
+
+        move_t buf[256];
+        movegen_t gen(board, true);
+        std::vector<move_t> root_moves(buf, buf + gen.gen_normal(buf));
+
+        auto context = std::make_unique<pvs::context_t>(&board, &evaluator, &eval_cache, &tt, 0);
+        std::atomic_bool aborted = false;
+        for (int depth = 1; depth <= 7; depth++) {
+            context->search_root(root_moves, nullptr, nullptr, -INF, INF, depth, aborted);
+            context->save_pv();
+        }
+
+        move_t saved_pv[MAX_PLY + 1];
+        int saved_pv_len = context->get_saved_pv(saved_pv);
+
+        std::ostringstream pv;
+        for (int j = 0; j < saved_pv_len; j++) pv << (j > 0 ? " " : "") << saved_pv[j];
+
+        INFO(bench_positions[i * 5]);
+        REQUIRE(pv.str() == expected[i]);
+    }
+}
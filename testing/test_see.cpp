@@ -2,9 +2,13 @@
 // Created by Vincent on 01/06/2018.
 //
 
+#include <random>
+
 #include <catch2/catch.hpp>
 #include "util.h"
 #include "../board.h"
+#include "../movegen.h"
+#include "../bench.h"
 
 TEST_CASE("Static Exchange Evaluation") {
     SECTION("Petroff") {
@@ -47,4 +51,47 @@ TEST_CASE("Static Exchange Evaluation") {
         REQUIRE(board.see(board.parse_move("e3e4")) == 0);
         REQUIRE(board.see(board.parse_move("d1d4")) == (VAL[PAWN] - VAL[QUEEN]));
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE("Threshold Static Exchange Evaluation") {
+    SECTION("Known positions") {
+        board_t board("r1bqkb1r/ppp2ppp/2n2n2/3pp1N1/2B1P3/8/PPPP1PPP/RNBQK2R w KQkq - 0 5");
+
+        REQUIRE(board.see_ge(board.parse_move("e4d5"), 0));
+        REQUIRE(!board.see_ge(board.parse_move("e4d5"), 1));
+        REQUIRE(board.see_ge(board.parse_move("g5f7"), VAL[PAWN] - VAL[KNIGHT]));
+        REQUIRE(!board.see_ge(board.parse_move("g5f7"), VAL[PAWN] - VAL[KNIGHT] + 1));
+        REQUIRE(!board.see_ge(board.parse_move("d1g4"), 0));
+        REQUIRE(board.see_ge(board.parse_move("d1g4"), -VAL[QUEEN]));
+    }
+
+    SECTION("Agrees with see over random games") {
+        std::mt19937_64 gen(0);
+        size_t checked = 0;
+
+        for (const std::string &fen : bench_positions) {
+            board_t board(fen);
+            for (int ply = 0; ply < 80; ply++) {
+                move_t buf[256];
+                movegen_t movegen(board, true);
+                int n = movegen.gen_normal(buf);
+                if (n == 0) break;
+
+                for (int i = 0; i < n; i++) {
+                    int see = board.see(buf[i]);
+                    for (int threshold : {see - 1, see, see + 1, -VAL[QUEEN], -VAL[PAWN], 0, VAL[PAWN], VAL[ROOK]}) {
+                        if (board.see_ge(buf[i], threshold) != (see >= threshold)) {
+                            INFO("position: " << board << " move: " << buf[i] << " threshold: " << threshold);
+                            REQUIRE(board.see_ge(buf[i], threshold) == (see >= threshold));
+                        }
+                    }
+                    checked++;
+                }
+
+                board.move(buf[gen() % n]);
+            }
+        }
+
+        REQUIRE(checked > 50000);
+    }
+}
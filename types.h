@@ -27,6 +27,16 @@ constexpr unsigned int MB = 1048576;
 typedef uint64_t U64;
 constexpr U64 ONES = ~U64(0);
 
+// Portable builds compile hot kernels for several x86-64 levels, and the loader picks the best one for the CPU
+#if defined(TOPPLE_DISPATCH) && defined(__x86_64__) && defined(__ELF__) && !defined(__clang__) && __GNUC__ >= 12
+#define TOPPLE_CLONES
+#define TOPPLE_HOT __attribute__((target_clones("arch=x86-64-v3", "arch=x86-64-v2", "default")))
+#elif defined(TOPPLE_DISPATCH)
+#error "TOPPLE_DISPATCH needs target_clones: GCC 12 or later, targeting x86-64 ELF"
+#else
+#define TOPPLE_HOT
+#endif
+
 // Timing
 typedef std::chrono::steady_clock engine_clock;
 #define CHRONO_DIFF(start, finish) std::chrono::duration_cast<std::chrono::milliseconds>((finish) - (start)).count()